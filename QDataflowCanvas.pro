@@ -2,29 +2,18 @@
 # Copyright (C) 2017-2018 Federico Ferri
 # Copyright (C) 2018 Kuba Ober
 
-QT += widgets
+# qdataflowmodel: the model, runtime and layouts (QtCore only)
+# qdataflowapp: the example application, with the canvas widget
+# qdataflowrun: runs a patch from the command line
 
-CONFIG += c++11
+TEMPLATE = subdirs
 
-TARGET = QDataflowCanvas
-TEMPLATE = app
+SUBDIRS = model app run
 
-SOURCES += \
-    main.cpp\
-    mainwindow.cpp \
-    qdataflowcanvas.cpp \
-    qdataflowmodel.cpp
+model.file = qdataflowmodel.pro
 
-HEADERS += \
-    mainwindow.h \
-    qdataflowcanvas.h \
-    qdataflowmodel.h \
-    utility.h
+app.file = qdataflowapp.pro
+app.depends = model
 
-FORMS += \
-    mainwindow.ui
-
-DEFINES += \
-    QT_DISABLE_DEPRECATED_BEFORE=0x060000 \
-    QT_RESTRICTED_CAST_FROM_ASCII \
-    QT_NO_KEYWORDS
+run.file = qdataflowrun.pro
+run.depends = model
@@ -0,0 +1,15 @@
+# QDataflowCanvas - a dataflow widget for Qt
+# Copyright (C) 2017-2018 Federico Ferri
+# Copyright (C) 2018 Kuba Ober
+
+CONFIG += c++11
+
+# the projects share this directory, so keep their build files apart
+OBJECTS_DIR = .obj/$$TARGET
+MOC_DIR = .moc/$$TARGET
+UI_DIR = .ui/$$TARGET
+
+DEFINES += \
+    QT_DISABLE_DEPRECATED_BEFORE=0x060000 \
+    QT_RESTRICTED_CAST_FROM_ASCII \
+    QT_NO_KEYWORDS
@@ -16,110 +16,15 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "mainwindow.h"
+#include "qdataflowminimap.h"
 #include "utility.h"
-#define _USE_MATH_DEFINES
-#include <cmath>
-#include <type_traits>
+#include <QAction>
+#include <QDockWidget>
+#include <QFileDialog>
 #include <QMenu>
 #include <QDebug>
-
-class DFSource : public QDataflowMetaObject
-{
-public:
-    DFSource(QDataflowModelNode *node, const QStringList &args)
-        : QDataflowMetaObject(node)
-    {
-        Q_UNUSED(args);
-
-        //setInletCount(0);
-        setOutletTypes({"int"});
-    }
-};
-
-class DFMathBinOp : public QDataflowMetaObject
-{
-public:
-    DFMathBinOp(QDataflowModelNode *node, const QStringList &args)
-        : QDataflowMetaObject(node)
-    {
-        s = 0;
-
-        setInletTypes({"int", "int"});
-        setOutletTypes({"int"});
-
-        op = args[0];
-
-        if(args.length() > 1)
-            s = args[1].toLong();
-    }
-
-    void onDataReceved(int inlet, void *data)
-    {
-        if(inlet == 0)
-        {
-            int r = reinterpret_cast<long>(data);
-            if(op == "add") r = r + s;
-            if(op == "sub") r = r - s;
-            if(op == "mul") r = r * s;
-            if(op == "div") r = r / s;
-            if(op == "pow") r = pow(r, s);
-            sendData(0, reinterpret_cast<void*>(r));
-        }
-        else if(inlet == 1)
-        {
-            s = reinterpret_cast<long>(data);
-        }
-    }
-
-private:
-    QString op;
-    int s;
-};
-
-class DFNum2Str : public QDataflowMetaObject
-{
-public:
-    DFNum2Str(QDataflowModelNode *node, const QStringList &args)
-        : QDataflowMetaObject(node)
-    {
-        Q_UNUSED(args);
-
-        setInletTypes({"int"});
-        setOutletTypes({"string"});
-    }
-
-    void onDataReceved(int inlet, void *data)
-    {
-        Q_UNUSED(inlet);
-
-        QString s = QString::number(reinterpret_cast<long>(data));
-        sendData(0, reinterpret_cast<void*>(&s));
-    }
-};
-
-class DFSink : public QDataflowMetaObject
-{
-public:
-    DFSink(QDataflowModelNode *node, const QStringList &args, QLineEdit *e)
-        : QDataflowMetaObject(node), e_(e)
-    {
-        Q_UNUSED(args);
-
-        setInletTypes({"string"});
-        //setOutletCount(0);
-    }
-
-    void onDataReceved(int inlet, void *data)
-    {
-        if(inlet == 0)
-        {
-            e_->setText(*reinterpret_cast<QString*>(data));
-        }
-    }
-
-private:
-    QLineEdit *e_;
-};
+#include <QElapsedTimer>
+#include <QtConcurrentRun>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -127,9 +32,18 @@ MainWindow::MainWindow(QWidget *parent)
     setupUi(this);
 
     QMenu *modelMenu = menuBar()->addMenu(tr("&Model"));
+    modelMenu->addAction("Open patch...", this, &MainWindow::onOpenPatch);
+    modelMenu->addAction("Save patch...", this, &MainWindow::onSavePatch);
     modelMenu->addAction("Dump to console", this, &MainWindow::onDumpModel);
+    modelMenu->addAction("Benchmark 100k nodes", this, &MainWindow::onBenchmark);
+    QAction *virtualizedAction = modelMenu->addAction("Virtualized canvas", canvas, &QDataflowCanvas::setVirtualized);
+    virtualizedAction->setCheckable(true);
+
+    QMenu *layoutMenu = menuBar()->addMenu(tr("&Layout"));
+    layoutMenu->addAction("Layered", this, &MainWindow::onLayeredLayout);
+    layoutMenu->addAction("Force-directed", this, &MainWindow::onForceDirectedLayout);
 
-    classList << "add" << "sub" << "mul" << "div" << "pow" << "source" << "sink" << "num2str";
+    runtime = new QDataflowRuntime(this);
     canvas->setCompletion(this);
     canvas->setShowObjectHoverFeedback(true);
     canvas->setShowConnectionHoverFeedback(true);
@@ -137,13 +51,24 @@ MainWindow::MainWindow(QWidget *parent)
     canvas->setGridSize(10);
     canvas->setDrawGrid(true);
 
+    QDockWidget *minimapDock = new QDockWidget(tr("Overview"), this);
+    QDataflowMinimap *minimap = new QDataflowMinimap(minimapDock);
+    minimap->setCanvas(canvas);
+    minimapDock->setWidget(minimap);
+    addDockWidget(Qt::RightDockWidgetArea, minimapDock);
+    QMenu *viewMenu = menuBar()->addMenu(tr("&View"));
+    viewMenu->addAction(minimapDock->toggleViewAction());
+
+    QObject::connect(&patchLoad, &QFutureWatcher<bool>::finished, this, &MainWindow::onPatchLoaded);
+
     QDataflowModel *model = canvas->model();
 
     new QDataflowModelDebugSignals(model);
 
+    runtime->setModel(model);
+
     QObject::connect(sendButton, &QPushButton::clicked, this, &MainWindow::processData);
-    QObject::connect(model, &QDataflowModel::nodeTextChanged, this, &MainWindow::onNodeTextChanged);
-    QObject::connect(model, &QDataflowModel::nodeAdded, this, &MainWindow::onNodeAdded);
+    QObject::connect(runtime, &QDataflowRuntime::output, this, &MainWindow::onOutput);
     QObject::connect(canvas->scene(), &QGraphicsScene::selectionChanged, this, &MainWindow::onSelectionChanged);
 
     // set up a small dataflow graph:
@@ -159,42 +84,21 @@ MainWindow::MainWindow(QWidget *parent)
 QStringList MainWindow::complete(const QString &txt)
 {
     QStringList completionList;
-    for (auto &className : as_const(classList))
+    for (auto &className : as_const(runtime->classNames()))
         if(className.startsWith(txt) && className.length() > txt.length())
             completionList << className;
     return completionList;
 }
 
-void MainWindow::setupNode(QDataflowModelNode *node)
-{
-    QStringList toks = node->text().split(QRegExp("(\\ |\\t)"));
-    if(!classList.contains(toks[0]))
-    {
-        node->setValid(false);
-        return;
-    }
-    if(toks[0] == "source") {sourceNode = node; node->setDataflowMetaObject(new DFSource(node, toks));}
-    else if(toks[0] == "sink") node->setDataflowMetaObject(new DFSink(node, toks, result));
-    else if(toks[0] == "num2str") node->setDataflowMetaObject(new DFNum2Str(node, toks));
-    else node->setDataflowMetaObject(new DFMathBinOp(node, toks));
-    node->setValid(true);
-}
-
 void MainWindow::processData()
 {
-    long x = input->value();
-    sourceNode->dataflowMetaObject()->sendData(0, reinterpret_cast<void*>(x));
+    runtime->send(input->value());
 }
 
-void MainWindow::onNodeAdded(QDataflowModelNode *node)
+void MainWindow::onOutput(QDataflowModelNode *node, const QString &text)
 {
-    setupNode(node);
-}
-
-void MainWindow::onNodeTextChanged(QDataflowModelNode *node, const QString &text)
-{
-    Q_UNUSED(text);
-    setupNode(node);
+    Q_UNUSED(node);
+    result->setText(text);
 }
 
 void MainWindow::onSelectionChanged()
@@ -229,3 +133,110 @@ void MainWindow::onDumpModel()
     for (auto *conn : as_const(model->connections()))
         qDebug() << "DUMP: connection: " << conn;
 }
+
+MainWindow::~MainWindow()
+{
+    // the worker still refers to the model
+    patchLoad.waitForFinished();
+}
+
+void MainWindow::onBenchmark()
+{
+    // replaces the current model with a 400x250 grid of nodes, each one
+    // connected to the node above it, and measures time to first frame:
+    const int cols = 400, rows = 250;
+    QElapsedTimer timer;
+    timer.start();
+
+    patchLoad.waitForFinished();
+    QDataflowModel *model = new QDataflowModel;
+    QVector<QDataflowModelNode*> above(cols);
+    for(int r = 0; r < rows; r++)
+    {
+        for(int c = 0; c < cols; c++)
+        {
+            QDataflowModelNode *node = model->create(QPoint(c * 80, r * 60), "add 1", 2, 1);
+            node->setValid(true);
+            if(above[c]) model->connect(above[c], 0, node, 0);
+            above[c] = node;
+        }
+    }
+    qint64 modelTime = timer.restart();
+
+    canvas->setModel(model);
+    qint64 itemsTime = timer.restart();
+
+    canvas->viewport()->repaint();
+    qint64 paintTime = timer.elapsed();
+    runtime->setModel(model);
+
+    QString msg = QString("%1 nodes: model %2 ms, items %3 ms, first frame %4 ms")
+            .arg(cols * rows).arg(modelTime).arg(itemsTime).arg(paintTime);
+    qDebug() << "BENCHMARK:" << msg;
+    statusbar->showMessage(msg);
+}
+
+void MainWindow::onOpenPatch()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open patch"), {}, tr("Patches (*.json)"));
+    if(fileName.isEmpty()) return;
+
+    // the previous model is about to be replaced:
+    patchLoad.waitForFinished();
+
+    // loaded by a worker thread: the canvas shows the patch as it is read,
+    // while the editor stays responsive
+    QDataflowModel *model = new QDataflowModel;
+    canvas->setModel(model);
+    runtime->setModel(model);
+    statusbar->showMessage(QString("Loading %1...").arg(fileName));
+    patchLoad.setFuture(QtConcurrent::run([model, fileName] {
+        return model->load(fileName);
+    }));
+}
+
+void MainWindow::onPatchLoaded()
+{
+    if(patchLoad.result())
+        statusbar->clearMessage();
+    else
+        statusbar->showMessage(QString("Some nodes or connections of the patch are invalid"));
+}
+
+void MainWindow::onSavePatch()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save patch"), {}, tr("Patches (*.json)"));
+    if(fileName.isEmpty()) return;
+
+    if(!canvas->model()->save(fileName))
+        statusbar->showMessage(QString("Cannot write %1").arg(fileName));
+}
+
+void MainWindow::onLayeredLayout()
+{
+    runLayout(QDataflowLayout::Layered);
+}
+
+void MainWindow::onForceDirectedLayout()
+{
+    runLayout(QDataflowLayout::ForceDirected);
+}
+
+void MainWindow::runLayout(QDataflowLayout::Algorithm algorithm)
+{
+    // the layout is owned by the model, so replacing the model cancels it
+    QDataflowModel *model = canvas->model();
+    QDataflowLayout *layout = new QDataflowLayout(model, model);
+    layout->setAlgorithm(algorithm);
+    layout->setNodeWidth([this](QDataflowModelNode *node) {return canvas->nodeWidth(node);});
+    const int count = model->nodes().size();
+    QElapsedTimer timer;
+    timer.start();
+    QObject::connect(layout, &QDataflowLayout::finished, this, [this, layout, count, timer]() {
+        QString msg = QString("Layout of %1 nodes: %2 ms").arg(count).arg(timer.elapsed());
+        qDebug() << "LAYOUT:" << msg;
+        statusbar->showMessage(msg);
+        layout->deleteLater();
+    });
+    layout->start();
+}
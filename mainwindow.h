@@ -18,8 +18,12 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include <QFutureWatcher>
+
 #include "ui_mainwindow.h"
 #include "qdataflowcanvas.h"
+#include "qdataflowlayout.h"
+#include "qdataflowruntime.h"
 
 class MainWindow : public QMainWindow, private Ui::MainWindow, private QDataflowTextCompletion
 {
@@ -27,20 +31,27 @@ class MainWindow : public QMainWindow, private Ui::MainWindow, private QDataflow
 
 public:
     MainWindow(QWidget *parent = {});
+    ~MainWindow();
 
     QStringList complete(const QString &txt) override;
 
 private:
-    QDataflowModelNode *sourceNode;
-    QStringList classList;
+    void runLayout(QDataflowLayout::Algorithm algorithm);
+
+    QDataflowRuntime *runtime;
+    QFutureWatcher<bool> patchLoad;
 
 private Q_SLOTS:
-    void setupNode(QDataflowModelNode *node);
     void processData();
-    void onNodeAdded(QDataflowModelNode *node);
-    void onNodeTextChanged(QDataflowModelNode *node, const QString &text);
+    void onOutput(QDataflowModelNode *node, const QString &text);
     void onSelectionChanged();
     void onDumpModel();
+    void onBenchmark();
+    void onOpenPatch();
+    void onSavePatch();
+    void onPatchLoaded();
+    void onLayeredLayout();
+    void onForceDirectedLayout();
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,25 @@
+# QDataflowCanvas - a dataflow widget for Qt
+# Copyright (C) 2017-2018 Federico Ferri
+# Copyright (C) 2018 Kuba Ober
+
+QT += widgets
+
+TARGET = QDataflowCanvas
+TEMPLATE = app
+
+include(common.pri)
+include(qdataflowmodel.pri)
+
+SOURCES += \
+    main.cpp\
+    mainwindow.cpp \
+    qdataflowcanvas.cpp \
+    qdataflowminimap.cpp
+
+HEADERS += \
+    mainwindow.h \
+    qdataflowcanvas.h \
+    qdataflowminimap.h
+
+FORMS += \
+    mainwindow.ui
@@ -27,21 +27,25 @@
 #include <QDebug>
 
 #include <QGraphicsScene>
+#include <QGraphicsSceneHoverEvent>
 #include <QGraphicsSceneMouseEvent>
+#include <QGraphicsSceneWheelEvent>
 #include <QGraphicsDropShadowEffect>
+#include <QFontMetricsF>
 #include <QMouseEvent>
 #include <QPainter>
 #include <QStyleOption>
 #include <QApplication>
 #include <QTextCursor>
 #include <QTextDocument>
+#include <QTimer>
 
 QDataflowCanvas::QDataflowCanvas(QWidget *parent)
-    : QGraphicsView(parent), model_()
+    : QGraphicsView(parent), model_(), editNode_(), connectionLayer_(), tooltip_()
 {
     QGraphicsScene *scene = new QGraphicsScene(this);
     scene->setItemIndexMethod(QGraphicsScene::NoIndex);
-    scene->setSceneRect(0, 0, 200, 200);
+    scene->setSceneRect(minimumSceneRect());
     setScene(scene);
     setCacheMode(CacheBackground);
     setViewportUpdateMode(BoundingRectViewportUpdate);
@@ -60,24 +64,71 @@ QDataflowCanvas::QDataflowCanvas(QWidget *parent)
 
     setDragMode(QGraphicsView::RubberBandDrag);
 
-    setModel(new QDataflowModel(this));
+    connectionsTimer_ = new QTimer(this);
+    connectionsTimer_->setSingleShot(true);
+    connectionsTimer_->setInterval(0);
+    QObject::connect(connectionsTimer_, &QTimer::timeout, this, &QDataflowCanvas::adjustDirtyConnections);
+
+    deferredConnectionsTimer_ = new QTimer(this);
+    deferredConnectionsTimer_->setSingleShot(true);
+    deferredConnectionsTimer_->setInterval(500);
+    deferredConnectionsTimer_->setTimerType(Qt::VeryCoarseTimer);
+    QObject::connect(deferredConnectionsTimer_, &QTimer::timeout, this, &QDataflowCanvas::adjustDeferredConnections);
+
+    sceneRectTimer_ = new QTimer(this);
+    sceneRectTimer_->setSingleShot(true);
+    sceneRectTimer_->setInterval(1000);
+    QObject::connect(sceneRectTimer_, &QTimer::timeout, this, &QDataflowCanvas::shrinkSceneRect);
+
+    virtualTimer_ = new QTimer(this);
+    virtualTimer_->setSingleShot(true);
+    virtualTimer_->setInterval(0);
+    QObject::connect(virtualTimer_, &QTimer::timeout, this, &QDataflowCanvas::updateVirtualItems);
+    QObject::connect(this, &QGraphicsView::rubberBandChanged, this, &QDataflowCanvas::onRubberBandChanged);
 
     showObjectHoverFeedback_ = false;
     showConnectionHoverFeedback_ = false;
     showIOletsTooltips_ = false;
     gridSize_ = 1.0;
     drawGrid_ = false;
+    spatialIndexThreshold_ = 1000;
+    topZValue_ = 0;
+    draggingNodes_ = false;
+    dragUpdateInterval_ = 100;
+    textDetailThreshold_ = 0.5;
+    ioletDetailThreshold_ = 0.4;
+    connectionDetailThreshold_ = 0.5;
+    bulkUpdate_ = 0;
+    bulkUpdateThreshold_ = 100;
+    bulkChanges_ = false;
+    virtualized_ = false;
+
+    setModel(new QDataflowModel(this));
+}
+
+QDataflowCanvas::Style::Style()
+{
+    for(int sel = 0; sel < 2; sel++)
+    {
+        QColor color = sel ? Qt::blue : Qt::black;
+        objectPen[sel][0] = QPen(color, 1, Qt::DashLine);
+        objectPen[sel][1] = QPen(color, 1, Qt::SolidLine);
+        connectionPen[sel] = QPen(color, 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
+        thinConnectionPen[sel] = QPen(color, 0);
+    }
+    objectBrush = QBrush(Qt::white);
+    headerBrush = QBrush(Qt::lightGray);
+    tempConnectionPen = QPen(Qt::gray, 1, Qt::DashLine, Qt::RoundCap, Qt::RoundJoin);
+    invalidConnectionPen = QPen(Qt::red, 1, Qt::DashLine, Qt::RoundCap, Qt::RoundJoin);
 }
 
 QDataflowCanvas::~QDataflowCanvas()
 {
     scene()->clearSelection();
 
-    for (auto *node : as_const(ownedNodes_))
-        delete node;
-
-    for (auto *conn : as_const(ownedConnections_))
-        delete conn;
+    // with batched connections, the connection items are not in the scene
+    removeAllItems();
+    qDeleteAll(nodePool_);
 }
 
 QDataflowModel * QDataflowCanvas::model()
@@ -93,12 +144,16 @@ void QDataflowCanvas::setModel(QDataflowModel *model)
         QObject::disconnect(model_, &QDataflowModel::nodeRemoved, this, &QDataflowCanvas::onNodeRemoved);
         QObject::disconnect(model_, &QDataflowModel::nodeValidChanged, this, &QDataflowCanvas::onNodeValidChanged);
         QObject::disconnect(model_, &QDataflowModel::nodePosChanged, this, &QDataflowCanvas::onNodePosChanged);
+        QObject::disconnect(model_, &QDataflowModel::nodesPosChanged, this, &QDataflowCanvas::onNodesPosChanged);
         QObject::disconnect(model_, &QDataflowModel::nodeTextChanged, this, &QDataflowCanvas::onNodeTextChanged);
         QObject::disconnect(model_, &QDataflowModel::nodeInletCountChanged, this, &QDataflowCanvas::onNodeInletCountChanged);
         QObject::disconnect(model_, &QDataflowModel::nodeOutletCountChanged, this, &QDataflowCanvas::onNodeOutletCountChanged);
         QObject::disconnect(model_, &QDataflowModel::connectionAdded, this, &QDataflowCanvas::onConnectionAdded);
         QObject::disconnect(model_, &QDataflowModel::connectionRemoved, this, &QDataflowCanvas::onConnectionRemoved);
+        QObject::disconnect(model_, &QDataflowModel::changesAboutToBeApplied, this, &QDataflowCanvas::onChangesAboutToBeApplied);
+        QObject::disconnect(model_, &QDataflowModel::changesApplied, this, &QDataflowCanvas::onChangesApplied);
         model_->deleteLater();
+        removeAllItems();
     }
 
     model_ = model;
@@ -107,45 +162,369 @@ void QDataflowCanvas::setModel(QDataflowModel *model)
     QObject::connect(model_, &QDataflowModel::nodeRemoved, this, &QDataflowCanvas::onNodeRemoved);
     QObject::connect(model_, &QDataflowModel::nodeValidChanged, this, &QDataflowCanvas::onNodeValidChanged);
     QObject::connect(model_, &QDataflowModel::nodePosChanged, this, &QDataflowCanvas::onNodePosChanged);
+    QObject::connect(model_, &QDataflowModel::nodesPosChanged, this, &QDataflowCanvas::onNodesPosChanged);
     QObject::connect(model_, &QDataflowModel::nodeTextChanged, this, &QDataflowCanvas::onNodeTextChanged);
     QObject::connect(model_, &QDataflowModel::nodeInletCountChanged, this, &QDataflowCanvas::onNodeInletCountChanged);
     QObject::connect(model_, &QDataflowModel::nodeOutletCountChanged, this, &QDataflowCanvas::onNodeOutletCountChanged);
     QObject::connect(model_, &QDataflowModel::connectionAdded, this, &QDataflowCanvas::onConnectionAdded);
     QObject::connect(model_, &QDataflowModel::connectionRemoved, this, &QDataflowCanvas::onConnectionRemoved);
+    // the changes made by other threads come as one set, applied in bulk if large
+    QObject::connect(model_, &QDataflowModel::changesAboutToBeApplied, this, &QDataflowCanvas::onChangesAboutToBeApplied);
+    QObject::connect(model_, &QDataflowModel::changesApplied, this, &QDataflowCanvas::onChangesApplied);
+    Q_EMIT modelChanged(model_);
+
+    // build the items of an already populated model in one pass:
+    if(model_->nodes().isEmpty()) return;
+    if(virtualized_)
+    {
+        scene()->setSceneRect(nodesSceneRect());
+        updateVirtualItems();
+        return;
+    }
+    beginBulkUpdate();
+    for(auto *mdlnode : as_const(model_->nodes()))
+        onNodeAdded(mdlnode);
+    for(auto *mdlconn : as_const(model_->connections()))
+        onConnectionAdded(mdlconn);
+    endBulkUpdate();
 }
 
-QList<QDataflowNode*> QDataflowCanvas::selectedNodes()
+void QDataflowCanvas::beginBulkUpdate()
 {
-    auto const isSelected = [this](QDataflowNode *node){
-        return node->scene() == scene() && node->isSelected();
+    if(bulkUpdate_++ > 0) return;
+
+    // inserting into the BSP tree and repainting are deferred to the end
+    bulkViewportUpdateMode_ = viewportUpdateMode();
+    setViewportUpdateMode(NoViewportUpdate);
+    scene()->setItemIndexMethod(QGraphicsScene::NoIndex);
+}
+
+void QDataflowCanvas::endBulkUpdate()
+{
+    if(bulkUpdate_ == 0 || --bulkUpdate_ > 0) return;
+
+    updateItemIndexMethod();
+    scene()->setSceneRect(nodesSceneRect());
+    setViewportUpdateMode(bulkViewportUpdateMode_);
+    viewport()->update();
+}
+
+bool QDataflowCanvas::isBulkUpdating() const
+{
+    return bulkUpdate_ > 0;
+}
+
+bool QDataflowCanvas::virtualized()
+{
+    return virtualized_;
+}
+
+void QDataflowCanvas::setVirtualized(bool virtualized)
+{
+    if(virtualized_ == virtualized) return;
+    virtualized_ = virtualized;
+
+    if(virtualized_)
+    {
+        updateVirtualItems();
+        return;
+    }
+
+    // back to one item per node:
+    virtualRect_ = QRectF();
+    clearVirtualStubs();
+    beginBulkUpdate();
+    for(auto *mdlnode : as_const(model_->nodes()))
+        if(!nodes_.contains(mdlnode))
+            materializeNode(mdlnode);
+    for(auto *mdlconn : as_const(model_->connections()))
+        if(!connections_.contains(mdlconn))
+            materializeConnection(mdlconn);
+    endBulkUpdate();
+}
+
+void QDataflowCanvas::removeAllItems()
+{
+    hideTooltip();
+    endNodeDrag();
+    editNode_ = nullptr;
+    selectedNodes_.clear();
+    selectedConnections_.clear();
+    dirtyConnections_.clear();
+
+    for(auto *conn : as_const(connections_))
+    {
+        removeConnectionItem(conn);
+        delete conn;
+    }
+    for(auto *node : as_const(nodes_))
+    {
+        if(node->scene() == scene())
+            scene()->removeItem(node);
+        delete node;
+    }
+    connections_.clear();
+    nodes_.clear();
+    nodeIndex_.clear();
+    inletIndex_.clear();
+    clearVirtualStubs();
+    updateItemIndexMethod();
+}
+
+QDataflowNode * QDataflowCanvas::materializeNode(QDataflowModelNode *mdlnode)
+{
+    QDataflowNode *uinode;
+    if(!nodePool_.isEmpty())
+    {
+        uinode = nodePool_.takeLast();
+        uinode->setModelNode(mdlnode);
+    }
+    else
+    {
+        uinode = new QDataflowNode(this, mdlnode);
+    }
+    nodes_.insert(mdlnode, uinode);
+    scene()->addItem(uinode);
+    updateNodeIndex(uinode);
+    return uinode;
+}
+
+QDataflowConnection * QDataflowCanvas::materializeConnection(QDataflowModelConnection *mdlconn)
+{
+    // when virtualized, both ends may not have an item; and changes made by
+    // other threads can reach the model before their count changes reach the
+    // items, in which case materializeConnections() adds it later
+    QDataflowNode *src = nodes_.value(mdlconn->source()->node());
+    QDataflowNode *dst = nodes_.value(mdlconn->dest()->node());
+    if(!src || !dst || mdlconn->source()->index() >= src->outletCount() ||
+            mdlconn->dest()->index() >= dst->inletCount())
+        return nullptr;
+
+    QDataflowConnection *uiconn = new QDataflowConnection(this, mdlconn);
+    connections_.insert(mdlconn, uiconn);
+    if(connectionLayer_)
+    {
+        connectionLayer_->addConnection(uiconn);
+    }
+    else
+    {
+        scene()->addItem(uiconn);
+        if(!isBulkUpdating())
+            raiseItem(uiconn);
+    }
+    return uiconn;
+}
+
+void QDataflowCanvas::materializeConnections(QDataflowModelNode *mdlnode)
+{
+    for(auto *mdlinlet : as_const(mdlnode->inlets()))
+        for(auto *mdlconn : as_const(mdlinlet->connections()))
+            if(!connections_.contains(mdlconn))
+                materializeConnection(mdlconn);
+    for(auto *mdloutlet : as_const(mdlnode->outlets()))
+        for(auto *mdlconn : as_const(mdloutlet->connections()))
+            if(!connections_.contains(mdlconn))
+                materializeConnection(mdlconn);
+}
+
+void QDataflowCanvas::releaseNode(QDataflowNode *node)
+{
+    // the connections refer to the node's iolets, so they go first
+    for(auto *inlet : node->inlets_)
+        for(auto *conn : as_const(inlet->connections()))
+            releaseConnection(conn);
+    for(auto *outlet : node->outlets_)
+        for(auto *conn : as_const(outlet->connections()))
+            releaseConnection(conn);
+
+    if(node->tmpConn_)
+    {
+        delete node->tmpConn_;
+        node->tmpConn_ = nullptr;
+    }
+    node->dragOutlet_ = nullptr;
+    node->exitEditMode(true);
+    if(node->isSelected())
+        node->setSelected(false);
+    selectedNodes_.remove(node);
+    if(node->hoverIOlet_)
+    {
+        node->hoverIOlet_ = nullptr;
+        node->unsetCursor();
+        hideTooltip();
+    }
+
+    scene()->removeItem(node);
+    removeNodeIndex(node);
+    nodes_.remove(node->modelNode());
+
+    // keep some items around for reuse, instead of reallocating them
+    if(nodePool_.size() < nodePoolSize())
+        nodePool_.push_back(node);
+    else
+        delete node;
+}
+
+void QDataflowCanvas::releaseConnection(QDataflowConnection *conn)
+{
+    removeConnectionItem(conn);
+    dirtyConnections_.remove(conn);
+    conn->source()->removeConnection(conn);
+    conn->dest()->removeConnection(conn);
+    connections_.remove(conn->modelConnection());
+    delete conn;
+}
+
+void QDataflowCanvas::updateVirtualItems()
+{
+    if(!virtualized_) return;
+
+    const qreal m = virtualMargin();
+    virtualRect_ = visibleRect().adjusted(-m, -m, m, m);
+
+    // the nodes near the visible area, plus their nearest neighbours so that
+    // the connections leaving the area are drawn too; the neighbours are
+    // limited per node, so that a hub does not materialize the whole graph,
+    // and its other connections are drawn as stubs
+    const QList<QDataflowModelNode*> nearby = model_->nodesIn(virtualRect_);
+    QSet<QDataflowModelNode*> wanted;
+    for(auto *mdlnode : nearby)
+        wanted.insert(mdlnode);
+    QVector<QPair<qreal, QDataflowModelNode*>> neighbours;
+    for(auto *mdlnode : nearby)
+    {
+        neighbours.clear();
+        auto add = [&](QDataflowModelNode *neighbour) {
+            if(wanted.contains(neighbour)) return;
+            QPoint d = neighbour->pos() - mdlnode->pos();
+            neighbours.push_back(qMakePair(qreal(QPoint::dotProduct(d, d)), neighbour));
+        };
+        for(auto *mdlinlet : as_const(mdlnode->inlets()))
+            for(auto *mdlconn : as_const(mdlinlet->connections()))
+                add(mdlconn->source()->node());
+        for(auto *mdloutlet : as_const(mdlnode->outlets()))
+            for(auto *mdlconn : as_const(mdloutlet->connections()))
+                add(mdlconn->dest()->node());
+        int n = qMin(neighbours.size(), virtualNeighbourLimit());
+        std::partial_sort(neighbours.begin(), neighbours.begin() + n, neighbours.end());
+        for(int i = 0; i < n; i++)
+            wanted.insert(neighbours[i].second);
+    }
+
+    // items the user is interacting with are kept wherever they are:
+    for(auto *node : as_const(selectedNodes_))
+        wanted.insert(node->modelNode());
+    if(editNode_)
+        wanted.insert(editNode_->modelNode());
+    if(QDataflowNode *grabber = qgraphicsitem_cast<QDataflowNode*>(scene()->mouseGrabberItem()))
+        wanted.insert(grabber->modelNode());
+
+    QList<QDataflowNode*> unwanted;
+    for(auto *node : as_const(nodes_))
+        if(!wanted.contains(node->modelNode()))
+            unwanted.push_back(node);
+    for(auto *node : as_const(unwanted))
+        releaseNode(node);
+
+    for(auto *mdlnode : as_const(wanted))
+        if(!nodes_.contains(mdlnode))
+            materializeNode(mdlnode);
+
+    // now every wanted node has an item:
+    for(auto *mdlnode : as_const(wanted))
+        for(auto *mdloutlet : as_const(mdlnode->outlets()))
+            for(auto *mdlconn : as_const(mdloutlet->connections()))
+                if(!connections_.contains(mdlconn))
+                    materializeConnection(mdlconn);
+
+    updateVirtualStubs();
+    updateItemIndexMethod();
+}
+
+void QDataflowCanvas::updateVirtualStubs()
+{
+    virtualStubs_.clear();
+    virtualStubNodes_.clear();
+    auto add = [this](QDataflowModelConnection *mdlconn, bool fromOutlet) {
+        QDataflowModelIOlet *end = fromOutlet ? static_cast<QDataflowModelIOlet*>(mdlconn->source()) : mdlconn->dest();
+        QDataflowModelNode *other = fromOutlet ? mdlconn->dest()->node() : mdlconn->source()->node();
+        if(nodes_.contains(other)) return;
+        // without an item the other node's size is unknown: its position is used
+        virtualStubs_.insert(mdlconn, VirtualStub{end->node(), end->index(), fromOutlet, other->pos()});
+        virtualStubNodes_.insert(end->node());
+        virtualStubNodes_.insert(other);
     };
-    QList<QDataflowNode*> ret;
-    std::copy_if(nodes_.begin(), nodes_.end(), std::back_inserter(ret), isSelected);
+    for(auto *node : as_const(nodes_))
+    {
+        QDataflowModelNode *mdlnode = node->modelNode();
+        for(auto *mdlinlet : as_const(mdlnode->inlets()))
+            for(auto *mdlconn : as_const(mdlinlet->connections()))
+                add(mdlconn, false);
+        for(auto *mdloutlet : as_const(mdlnode->outlets()))
+            for(auto *mdlconn : as_const(mdloutlet->connections()))
+                add(mdlconn, true);
+    }
+    // the stubs are drawn with the (cached) background
+    resetCachedContent();
+}
+
+void QDataflowCanvas::clearVirtualStubs()
+{
+    if(virtualStubs_.isEmpty()) return;
+    virtualStubs_.clear();
+    virtualStubNodes_.clear();
+    resetCachedContent();
+}
+
+QDataflowInlet * QDataflowCanvas::inletAt(const QPointF &scenePos, QDataflowOutlet *compatibleWith) const
+{
+    QDataflowInlet *ret = nullptr;
+    qreal retDistance = 0;
+    inletIndex_.visit(scenePos, [&](QDataflowInlet *inlet, const QRectF &rect) {
+        if(!inlet->isVisible()) return;
+        QPointF d = rect.center() - scenePos;
+        qreal distance = QPointF::dotProduct(d, d);
+        if(ret && distance >= retDistance) return;
+        if(compatibleWith && !canConnect(compatibleWith, inlet)) return;
+        ret = inlet;
+        retDistance = distance;
+    });
     return ret;
 }
 
+bool QDataflowCanvas::canConnect(QDataflowOutlet *outlet, QDataflowInlet *inlet) const
+{
+    QDataflowModelOutlet *mdloutlet = outlet->node()->modelNode()->outlet(outlet->index());
+    QDataflowModelInlet *mdlinlet = inlet->node()->modelNode()->inlet(inlet->index());
+    if(!mdloutlet || !mdlinlet) return false;
+    return mdloutlet->canMakeConnectionTo(mdlinlet) && mdlinlet->canAcceptConnectionFrom(mdloutlet);
+}
+
+QRectF QDataflowCanvas::visibleRect() const
+{
+    return mapToScene(viewport()->rect()).boundingRect();
+}
+
+QList<QDataflowNode*> QDataflowCanvas::selectedNodes()
+{
+    return selectedNodes_.values();
+}
+
 QList<QDataflowConnection*> QDataflowCanvas::selectedConnections()
 {
-    auto const isSelected = [this](QDataflowConnection *conn){
-        return conn->scene() == scene() && conn->isSelected();
-    };
-    QList<QDataflowConnection*> ret;
-    std::copy_if(connections_.begin(), connections_.end(), std::back_inserter(ret), isSelected);
-    return ret;
+    return selectedConnections_.values();
 }
 
 bool QDataflowCanvas::isSomeNodeInEditMode() const
 {
-    auto const inEditMode = [this](QDataflowNode *node){
-        return node->scene() == scene() && node->isInEditMode();
-    };
-    return std::any_of(nodes_.begin(), nodes_.end(), inEditMode);
+    // the label may also lose focus without going through exitEditMode()
+    return editNode_ && editNode_->isInEditMode();
 }
 
 QDataflowNode * QDataflowCanvas::node(QDataflowModelNode *node)
 {
-    auto it = nodes_.find(node);
-    if(it == nodes_.end())
+    auto it = nodes_.constFind(node);
+    if(it == nodes_.constEnd())
     {
         qWarning() << this << "does not know about" << node;
         return {};
@@ -153,10 +532,22 @@ QDataflowNode * QDataflowCanvas::node(QDataflowModelNode *node)
     return *it;
 }
 
+qreal QDataflowCanvas::nodeWidth(QDataflowModelNode *mdlnode) const
+{
+    if(QDataflowNode *uinode = nodes_.value(mdlnode))
+        return uinode->objectRect().width();
+
+    // as QDataflowNode::adjust() sizes it, with the default metrics
+    const qreal margin = 4, ioletWidth = 10, ioletSpacing = 13;
+    const qreal textWidth = QFontMetricsF(font()).boundingRect(mdlnode->text()).width() + 2 * margin;
+    const int iolets = qMax(mdlnode->inletCount(), mdlnode->outletCount());
+    return qMax(textWidth, iolets * (ioletWidth + ioletSpacing) - ioletSpacing);
+}
+
 QDataflowConnection * QDataflowCanvas::connection(QDataflowModelConnection *conn)
 {
-    QMap<QDataflowModelConnection*, QDataflowConnection*>::Iterator it = connections_.find(conn);
-    if(it == connections_.end())
+    auto it = connections_.constFind(conn);
+    if(it == connections_.constEnd())
     {
         qDebug() << "WARNING:" << this << "does not know about" << conn;
         return {};
@@ -166,28 +557,25 @@ QDataflowConnection * QDataflowCanvas::connection(QDataflowModelConnection *conn
 
 void QDataflowCanvas::raiseItem(QGraphicsItem *item)
 {
-    qreal maxZ = 0;
-    for(auto *item1 : as_const(item->collidingItems(Qt::IntersectsItemBoundingRect)))
-        maxZ = qMax(maxZ, item1->zValue());
-    item->setZValue(maxZ + 1);
+    if(!item->scene()) return;
+
+    // z-values are handed out by a counter, so the raised item ends up
+    // above everything raised before it without looking at its neighbours
+    item->setZValue(++topZValue_);
+
+    if(connectionLayer_) return;
 
     if(QDataflowNode *node = dynamic_cast<QDataflowNode*>(item))
     {
         for(int i = 0; i < node->inletCount(); i++)
         {
-            QDataflowInlet *inlet = node->inlet(i);
-            for(auto *conn : as_const(inlet->connections()))
-            {
-                raiseItem(conn);
-            }
+            for(auto *conn : as_const(node->inlet(i)->connections()))
+                conn->setZValue(++topZValue_);
         }
         for(int i = 0; i < node->outletCount(); i++)
         {
-            QDataflowOutlet *outlet = node->outlet(i);
-            for(auto *conn : as_const(outlet->connections()))
-            {
-                raiseItem(conn);
-            }
+            for(auto *conn : as_const(node->outlet(i)->connections()))
+                conn->setZValue(++topZValue_);
         }
     }
 }
@@ -227,7 +615,7 @@ void QDataflowCanvas::setShowObjectHoverFeedback(bool show)
 
     for (auto *node : as_const(nodes_))
     {
-        node->setAcceptHoverEvents(show);
+        node->update();
     }
 }
 
@@ -260,6 +648,7 @@ qreal QDataflowCanvas::gridSize()
 void QDataflowCanvas::setGridSize(qreal sz)
 {
     gridSize_ = qMax(1.0, sz);
+    resetCachedContent();
 }
 
 bool QDataflowCanvas::drawGrid()
@@ -270,6 +659,297 @@ bool QDataflowCanvas::drawGrid()
 void QDataflowCanvas::setDrawGrid(bool draw)
 {
     drawGrid_ = draw;
+    resetCachedContent();
+}
+
+int QDataflowCanvas::spatialIndexThreshold()
+{
+    return spatialIndexThreshold_;
+}
+
+void QDataflowCanvas::setSpatialIndexThreshold(int count)
+{
+    spatialIndexThreshold_ = qMax(0, count);
+    updateItemIndexMethod();
+}
+
+int QDataflowCanvas::bulkUpdateThreshold()
+{
+    return bulkUpdateThreshold_;
+}
+
+void QDataflowCanvas::setBulkUpdateThreshold(int count)
+{
+    bulkUpdateThreshold_ = qMax(0, count);
+}
+
+qreal QDataflowCanvas::textDetailThreshold()
+{
+    return textDetailThreshold_;
+}
+
+void QDataflowCanvas::setTextDetailThreshold(qreal lod)
+{
+    textDetailThreshold_ = lod;
+    viewport()->update();
+}
+
+qreal QDataflowCanvas::ioletDetailThreshold()
+{
+    return ioletDetailThreshold_;
+}
+
+void QDataflowCanvas::setIOletDetailThreshold(qreal lod)
+{
+    ioletDetailThreshold_ = lod;
+    viewport()->update();
+}
+
+qreal QDataflowCanvas::connectionDetailThreshold()
+{
+    return connectionDetailThreshold_;
+}
+
+void QDataflowCanvas::setConnectionDetailThreshold(qreal lod)
+{
+    connectionDetailThreshold_ = lod;
+    viewport()->update();
+}
+
+bool QDataflowCanvas::batchedConnections()
+{
+    return connectionLayer_;
+}
+
+void QDataflowCanvas::setBatchedConnections(bool batched)
+{
+    if(batched == bool(connectionLayer_)) return;
+
+    if(batched)
+    {
+        connectionLayer_ = new QDataflowConnectionLayer(this);
+        scene()->addItem(connectionLayer_);
+        for(auto *conn : as_const(connections_))
+        {
+            if(conn->scene() != scene()) continue;
+            scene()->removeItem(conn);
+            connectionLayer_->addConnection(conn);
+        }
+    }
+    else
+    {
+        QDataflowConnectionLayer *layer = connectionLayer_;
+        connectionLayer_ = nullptr;
+        for(auto *conn : as_const(layer->connections()))
+        {
+            layer->removeConnection(conn);
+            scene()->addItem(conn);
+            raiseItem(conn);
+        }
+        scene()->removeItem(layer);
+        delete layer;
+    }
+}
+
+bool QDataflowCanvas::isConnectionShown(QDataflowConnection *conn) const
+{
+    if(connectionLayer_)
+        return connectionLayer_->hasConnection(conn);
+    return conn->scene() == scene();
+}
+
+void QDataflowCanvas::removeConnectionItem(QDataflowConnection *conn)
+{
+    selectedConnections_.remove(conn);
+    if(connectionLayer_)
+    {
+        connectionLayer_->removeConnection(conn);
+        // the layer's bounds are updated by adjustDirtyConnections()
+        if(!connectionsTimer_->isActive())
+            connectionsTimer_->start();
+    }
+    else if(conn->scene() == scene())
+    {
+        scene()->removeItem(conn);
+    }
+}
+
+void QDataflowCanvas::updateNodeIndex(QDataflowNode *node)
+{
+    // pad by the iolets' hit tolerance, which reaches out of the node bounds
+    const qreal pad = 2 * node->ioletHeight();
+    nodeIndex_.update(node, node->sceneBoundingRect().adjusted(-pad, -pad, pad, pad));
+    for(auto *inlet : node->inlets_)
+        inletIndex_.update(inlet, inlet->sceneBoundingRect());
+}
+
+void QDataflowCanvas::removeNodeIndex(QDataflowNode *node)
+{
+    nodeIndex_.remove(node);
+    for(auto *inlet : node->inlets_)
+        inletIndex_.remove(inlet);
+    updateItemIndexMethod();
+}
+
+void QDataflowCanvas::updateItemIndexMethod()
+{
+    if(isBulkUpdating()) return;
+
+    // small scenes are cheaper without an index, since item moves are free;
+    // switch back only well below the threshold to avoid re-indexing churn
+    int count = nodeIndex_.size();
+    QGraphicsScene::ItemIndexMethod method = scene()->itemIndexMethod();
+    if(method == QGraphicsScene::NoIndex && count >= spatialIndexThreshold_)
+        scene()->setItemIndexMethod(QGraphicsScene::BspTreeIndex);
+    else if(method == QGraphicsScene::BspTreeIndex && count < spatialIndexThreshold_ / 2)
+        scene()->setItemIndexMethod(QGraphicsScene::NoIndex);
+}
+
+int QDataflowCanvas::dragUpdateInterval()
+{
+    return dragUpdateInterval_;
+}
+
+void QDataflowCanvas::setDragUpdateInterval(int msec)
+{
+    dragUpdateInterval_ = qMax(0, msec);
+}
+
+void QDataflowCanvas::showTooltip(QDataflowIOlet *iolet)
+{
+    // one tooltip item serves all the iolets; it is created on first use
+    bool isInlet = iolet->type() == QDataflowItemTypeInlet;
+    QDataflowModelNode *mdlnode = iolet->node()->modelNode();
+    QDataflowModelIOlet *mdliolet = isInlet
+            ? static_cast<QDataflowModelIOlet*>(mdlnode->inlet(iolet->index()))
+            : static_cast<QDataflowModelIOlet*>(mdlnode->outlet(iolet->index()));
+    if(!mdliolet) return;
+
+    QPointF offset(0, isInlet ? -20 : 20);
+    if(!tooltip_)
+    {
+        tooltip_ = new QDataflowTooltip(nullptr, mdliolet->type(), offset);
+        tooltip_->setZValue(std::numeric_limits<qreal>::max());
+        scene()->addItem(tooltip_);
+    }
+    else
+    {
+        tooltip_->setText(mdliolet->type(), offset);
+    }
+    tooltip_->setPos(iolet->scenePos());
+    tooltip_->setVisible(true);
+}
+
+void QDataflowCanvas::hideTooltip()
+{
+    if(tooltip_)
+        tooltip_->setVisible(false);
+}
+
+void QDataflowCanvas::beginNodeDrag()
+{
+    endNodeDrag();
+    draggingNodes_ = true;
+    dragUpdateTimer_.start();
+}
+
+void QDataflowCanvas::nodeDragged(QDataflowNode *node)
+{
+    QPoint pos(node->pos().x(), node->pos().y());
+    draggedPositions_[node->modelNode()] = pos;
+    dragUpdates_[node->modelNode()] = pos;
+    growSceneRect(pos);
+
+    if(dragUpdateTimer_.elapsed() >= dragUpdateInterval_)
+    {
+        Q_EMIT nodesMoving(dragUpdates_);
+        dragUpdates_.clear();
+        dragUpdateTimer_.restart();
+    }
+}
+
+void QDataflowCanvas::endNodeDrag()
+{
+    if(!draggingNodes_) return;
+    draggingNodes_ = false;
+    dragUpdates_.clear();
+
+    // the model sees the whole drag as one change:
+    QHash<QDataflowModelNode*, QPoint> positions;
+    positions.swap(draggedPositions_);
+    if(!positions.isEmpty())
+        model_->setNodesPos(positions);
+}
+
+void QDataflowCanvas::scheduleConnectionAdjust(QDataflowConnection *conn)
+{
+    dirtyConnections_.insert(conn);
+    if(!connectionsTimer_->isActive())
+        connectionsTimer_->start();
+}
+
+void QDataflowCanvas::adjustDirtyConnections()
+{
+    // a connection moved by several nodes of a selection is recomputed only
+    // once; connections which are off-screen both before and after the
+    // move stay dirty until the visible area changes, or at most until
+    // adjustDeferredConnections()
+    QRectF visible = visibleRect();
+    QSet<QDataflowConnection*> deferred;
+    for(auto *conn : as_const(dirtyConnections_))
+    {
+        if(!isConnectionShown(conn)) continue;
+        QLineF line = conn->endpoints();
+        QRectF newRect = QRectF(line.p1(), line.p2()).normalized().adjusted(-1, -1, 1, 1);
+        if(newRect.intersects(visible) || conn->sceneBoundingRect().intersects(visible))
+            conn->adjust();
+        else
+            deferred.insert(conn);
+    }
+    dirtyConnections_.swap(deferred);
+    dirtyConnectionsVisibleRect_ = visible;
+    if(!dirtyConnections_.isEmpty() && !deferredConnectionsTimer_->isActive())
+        deferredConnectionsTimer_->start();
+    if(connectionLayer_)
+        connectionLayer_->updateBounds();
+}
+
+void QDataflowCanvas::adjustDeferredConnections()
+{
+    // so that hit-testing and the scene index do not use stale geometry
+    for(auto *conn : as_const(dirtyConnections_))
+        if(isConnectionShown(conn))
+            conn->adjust();
+    dirtyConnections_.clear();
+}
+
+void QDataflowCanvas::growSceneRect(const QPointF &pos)
+{
+    // grow by twice the margin, so that dragging a node outwards does not
+    // change the scene rect (and the scroll bars) on every mouse move
+    const qreal m = sceneRectMargin();
+    QRectF r = scene()->sceneRect();
+    if(r.contains(QRectF(pos.x() - m, pos.y() - m, 2 * m, 2 * m))) return;
+    scene()->setSceneRect(r.united(QRectF(pos.x() - 2 * m, pos.y() - 2 * m, 4 * m, 4 * m)));
+}
+
+QRectF QDataflowCanvas::nodesSceneRect()
+{
+    // computed from the model node positions, not from the items' bounds
+    if(model_->nodes().isEmpty()) return minimumSceneRect();
+    const qreal m = sceneRectMargin();
+    QRectF bounds = model_->nodesBounds().adjusted(-2 * m, -2 * m, 2 * m, 2 * m);
+    return bounds.united(minimumSceneRect());
+}
+
+void QDataflowCanvas::shrinkSceneRect()
+{
+    const qreal m = sceneRectMargin();
+    QRectF bounds = nodesSceneRect();
+
+    // only shrink if some side is more than a margin too far out
+    if(bounds.adjusted(-m, -m, m, m).contains(scene()->sceneRect())) return;
+    scene()->setSceneRect(bounds);
 }
 
 void QDataflowCanvas::drawBackground(QPainter *painter, const QRectF &rect)
@@ -278,15 +958,100 @@ void QDataflowCanvas::drawBackground(QPainter *painter, const QRectF &rect)
 
     if(drawGrid_)
     {
-        painter->setPen(QPen(Qt::gray));
-        for(qreal y = qCeil(rect.top() / gridSize_) * gridSize_; y <= rect.bottom(); y += gridSize_)
+        // when zoomed out, skip grid lines so that points stay at least
+        // minimumGridSpacing() pixels apart on screen
+        const qreal scale = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+        qreal step = gridSize_;
+        if(scale > 0)
+            while(step * scale < minimumGridSpacing())
+                step *= 2;
+
+        gridPoints_.clear();
+        for(qreal y = qCeil(rect.top() / step) * step; y <= rect.bottom(); y += step)
+            for(qreal x = qCeil(rect.left() / step) * step; x <= rect.right(); x += step)
+                gridPoints_.push_back(QPointF(int(x), int(y)));
+
+        painter->setPen(QPen(Qt::gray, 0));
+        painter->drawPoints(gridPoints_.constData(), gridPoints_.size());
+    }
+
+    if(!virtualStubs_.isEmpty())
+    {
+        stubLines_.clear();
+        for(auto it = virtualStubs_.constBegin(); it != virtualStubs_.constEnd(); ++it)
+        {
+            const VirtualStub &stub = it.value();
+            QDataflowNode *node = nodes_.value(stub.node);
+            if(!node || stub.index >= (stub.fromOutlet ? node->outletCount() : node->inletCount()))
+                continue;
+            // same endpoints as QDataflowConnection::endpoints()
+            QLineF line = stub.fromOutlet
+                    ? QLineF(node->outlet(stub.index)->scenePos() + QPointF(0, node->ioletHeight() / 2), stub.farPos)
+                    : QLineF(stub.farPos, node->inlet(stub.index)->scenePos() - QPointF(0, node->ioletHeight() / 2));
+            if(QRectF(line.p1(), line.p2()).normalized().adjusted(-1, -1, 1, 1).intersects(rect))
+                stubLines_.push_back(line);
+        }
+        bool thin = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform()) < connectionDetailThreshold();
+        painter->setPen(thin ? style_.thinConnectionPen[0] : style_.connectionPen[0]);
+        painter->drawLines(stubLines_);
+    }
+}
+
+void QDataflowCanvas::paintEvent(QPaintEvent *event)
+{
+    const QRectF visible = visibleRect();
+
+    if(!dirtyConnections_.isEmpty() && !connectionsTimer_->isActive() &&
+            visible != dirtyConnectionsVisibleRect_)
+        connectionsTimer_->start();
+
+    if(virtualized_ && !virtualTimer_->isActive())
+    {
+        // refill when the view gets within half a margin of the items'
+        // area, and drop items when it got much smaller (zooming in)
+        const qreal m = virtualMargin();
+        if(!virtualRect_.adjusted(m / 2, m / 2, -m / 2, -m / 2).contains(visible) ||
+                !visible.adjusted(-2 * m, -2 * m, 2 * m, 2 * m).contains(virtualRect_))
+            virtualTimer_->start();
+    }
+
+    if(visible != lastVisibleRect_)
+    {
+        lastVisibleRect_ = visible;
+        Q_EMIT visibleRectChanged(visible);
+    }
+
+    QGraphicsView::paintEvent(event);
+}
+
+void QDataflowCanvas::mousePressEvent(QMouseEvent *event)
+{
+    // batched connections are not scene items, and the layer has no shape,
+    // so the scene neither hits nor deselects them: clicks are handled here,
+    // unless an item is above
+    if(connectionLayer_ && event->button() == Qt::LeftButton && !itemAt(event->pos()))
+    {
+        if(QDataflowConnection *conn = connectionLayer_->connectionAt(mapToScene(event->pos())))
         {
-            for(qreal x = qCeil(rect.left() / gridSize_) * gridSize_; x <= rect.right(); x += gridSize_)
+            if(event->modifiers() & Qt::ControlModifier)
+            {
+                connectionLayer_->setConnectionSelected(conn, !conn->isSelected());
+            }
+            else
             {
-                painter->drawPoint(int(x), int(y));
+                scene()->clearSelection();
+                connectionLayer_->clearSelection();
+                connectionLayer_->setConnectionSelected(conn, true);
             }
+            event->accept();
+            return;
         }
     }
+
+    if(connectionLayer_ && !(event->modifiers() & Qt::ControlModifier))
+        connectionLayer_->clearSelection();
+
+    QGraphicsView::mousePressEvent(event);
 }
 
 void QDataflowCanvas::mouseDoubleClickEvent(QMouseEvent *event)
@@ -334,17 +1099,34 @@ void QDataflowCanvas::itemTextEditorTextChange()
     if(!item) return;
     QDataflowNode *node = dynamic_cast<QDataflowNode*>(item);
     if(!node) return;
-    node->adjust();
+    node->adjust(QDataflowNode::AdjustSize);
     txtItem->complete();
 }
 
+void QDataflowCanvas::onRubberBandChanged(QRect rubberBandRect, QPointF fromScenePoint, QPointF toScenePoint)
+{
+    if(rubberBandRect.isNull()) return;
+    adjustDeferredConnections();
+    if(!connectionLayer_) return;
+    connectionLayer_->selectConnections(QRectF(fromScenePoint, toScenePoint).normalized());
+}
+
 void QDataflowCanvas::onNodeAdded(QDataflowModelNode *mdlnode)
 {
-    QDataflowNode *uinode = new QDataflowNode(this, mdlnode);
-    nodes_[mdlnode] = uinode;
-    scene()->addItem(uinode);
+    // the item may exist already, if it was made from nodesIn() or nodes()
+    // while the signal was being emitted
+    if(nodes_.contains(mdlnode)) return;
+
+    // when virtualized, nodes away from the view get no item, unless
+    // they are about to be edited
+    QDataflowNode *uinode = nullptr;
+    if(!virtualized_ || mdlnode->text() == "" || virtualRect_.contains(mdlnode->pos()))
+        uinode = materializeNode(mdlnode);
+    if(isBulkUpdating()) return;
+    updateItemIndexMethod();
+    growSceneRect(mdlnode->pos());
 
-    if(mdlnode->text() == "")
+    if(uinode && mdlnode->text() == "")
     {
         uinode->enterEditMode();
     }
@@ -352,69 +1134,112 @@ void QDataflowCanvas::onNodeAdded(QDataflowModelNode *mdlnode)
 
 void QDataflowCanvas::onNodeRemoved(QDataflowModelNode *mdlnode)
 {
-    QDataflowNode *uinode = node(mdlnode);
-    if(uinode->isInEditMode())
-        uinode->exitEditMode(true);
-    scene()->removeItem(uinode);
+    if(QDataflowNode *uinode = nodes_.value(mdlnode))
+        releaseNode(uinode);
+    sceneRectTimer_->start();
 }
 
 void QDataflowCanvas::onNodeValidChanged(QDataflowModelNode *mdlnode, bool valid)
 {
-    QDataflowNode *uinode = node(mdlnode);
-    uinode->setValid(valid);
+    if(QDataflowNode *uinode = nodes_.value(mdlnode))
+        uinode->setValid(valid);
 }
 
 void QDataflowCanvas::onNodePosChanged(QDataflowModelNode *mdlnode, const QPoint &pos)
 {
-    QDataflowNode *uinode = node(mdlnode);
+    moveNodeItem(mdlnode, pos);
+    sceneRectTimer_->start();
+}
+
+void QDataflowCanvas::onNodesPosChanged(const QList<QDataflowModelNode*> &mdlnodes)
+{
+    for(auto *mdlnode : mdlnodes)
+        moveNodeItem(mdlnode, mdlnode->pos());
+    sceneRectTimer_->start();
+}
+
+void QDataflowCanvas::moveNodeItem(QDataflowModelNode *mdlnode, const QPoint &pos)
+{
+    QDataflowNode *uinode = nodes_.value(mdlnode);
+    if(virtualized_ && (bool(uinode) != virtualRect_.contains(pos) || virtualStubNodes_.contains(mdlnode)))
+        virtualTimer_->start();
     if(uinode)
     {
         uinode->setFlag(QGraphicsItem::ItemSendsGeometryChanges, false);
         uinode->setPos(pos);
         uinode->setFlag(QGraphicsItem::ItemSendsGeometryChanges, true);
+        updateNodeIndex(uinode);
+        uinode->adjustConnections();
     }
+    growSceneRect(pos);
 }
 
 void QDataflowCanvas::onNodeTextChanged(QDataflowModelNode *mdlnode, const QString &text)
 {
-    QDataflowNode *uinode = node(mdlnode);
-    uinode->setText(text);
+    if(QDataflowNode *uinode = nodes_.value(mdlnode))
+        uinode->setText(text);
 }
 
 void QDataflowCanvas::onNodeInletCountChanged(QDataflowModelNode *mdlnode, int count)
 {
-    QDataflowNode *uinode = node(mdlnode);
-    uinode->setInletCount(count);
+    if(QDataflowNode *uinode = nodes_.value(mdlnode))
+    {
+        uinode->setInletCount(count);
+        materializeConnections(mdlnode);
+    }
 }
 
 void QDataflowCanvas::onNodeOutletCountChanged(QDataflowModelNode *mdlnode, int count)
 {
-    QDataflowNode *uinode = node(mdlnode);
-    uinode->setOutletCount(count);
+    if(QDataflowNode *uinode = nodes_.value(mdlnode))
+    {
+        uinode->setOutletCount(count);
+        materializeConnections(mdlnode);
+    }
 }
 
 void QDataflowCanvas::onConnectionAdded(QDataflowModelConnection *mdlconn)
 {
-    QDataflowConnection *uiconn = new QDataflowConnection(this, mdlconn);
-    connections_[mdlconn] = uiconn;
-    scene()->addItem(uiconn);
-    raiseItem(uiconn);
+    if(connections_.contains(mdlconn)) return;
+    // with only one end having an item, it becomes a stub
+    if(!materializeConnection(mdlconn) && virtualized_ &&
+            (nodes_.contains(mdlconn->source()->node()) || nodes_.contains(mdlconn->dest()->node())))
+        virtualTimer_->start();
 }
 
 void QDataflowCanvas::onConnectionRemoved(QDataflowModelConnection *mdlconn)
 {
-    QDataflowConnection *uiconn = connection(mdlconn);
-    scene()->removeItem(uiconn);
+    if(QDataflowConnection *uiconn = connections_.value(mdlconn))
+        releaseConnection(uiconn);
+    if(virtualStubs_.remove(mdlconn))
+        resetCachedContent();
+}
+
+void QDataflowCanvas::onChangesAboutToBeApplied(int count)
+{
+    // a few changes (e.g. a node moved) are cheaper to apply one by one
+    // than rebuilding the scene index and repainting everything
+    bulkChanges_ = count >= bulkUpdateThreshold_;
+    if(bulkChanges_)
+        beginBulkUpdate();
+}
+
+void QDataflowCanvas::onChangesApplied()
+{
+    if(!bulkChanges_) return;
+    bulkChanges_ = false;
+    endBulkUpdate();
 }
 
 QDataflowNode::QDataflowNode(QDataflowCanvas *canvas, QDataflowModelNode *modelNode)
-    : canvas_(canvas), modelNode_(modelNode), valid_(true)
+    : canvas_(canvas), modelNode_(), textItem_(), valid_(true), hoverIOlet_(), dragOutlet_(), tmpConn_()
 {
     setFlag(ItemIsMovable);
     setFlag(ItemSendsGeometryChanges);
     setFlag(ItemIsSelectable);
     setAcceptedMouseButtons(Qt::LeftButton);
-    setAcceptHoverEvents(canvas_->showObjectHoverFeedback());
+    // also needed for iolet tooltips and the outlet cursor:
+    setAcceptHoverEvents(true);
     setCacheMode(DeviceCoordinateCache);
 
 #if 0
@@ -425,34 +1250,44 @@ QDataflowNode::QDataflowNode(QDataflowCanvas *canvas, QDataflowModelNode *modelN
     setGraphicsEffect(shadowFx);
 #endif
 
-    inputHeader_ = new QGraphicsRectItem(this);
+    // the editable text item is only created in edit mode:
+    staticText_.setTextFormat(Qt::PlainText);
 
-    objectBox_ = new QGraphicsRectItem(this);
+    setAcceptTouchEvents(false);
 
-    outputHeader_ = new QGraphicsRectItem(this);
+    setModelNode(modelNode);
+}
 
-    textItem_ = new QDataflowNodeTextLabel(this, objectBox_);
-    textItem_->document()->setPlainText(modelNode->text());
+QDataflowNode::~QDataflowNode()
+{
+    qDeleteAll(inlets_);
+    qDeleteAll(outlets_);
+}
+
+QDataflowModelNode * QDataflowNode::modelNode() const
+{
+    return modelNode_;
+}
 
-    QObject::connect(textItem_->document(), &QTextDocument::contentsChanged, canvas, &QDataflowCanvas::itemTextEditorTextChange);
+void QDataflowNode::setModelNode(QDataflowModelNode *modelNode)
+{
+    modelNode_ = modelNode;
+    valid_ = modelNode->isValid();
+    hoverIOlet_ = nullptr;
 
-    setAcceptTouchEvents(false);
-    inputHeader_->setAcceptTouchEvents(false);
-    objectBox_->setAcceptTouchEvents(false);
-    outputHeader_->setAcceptTouchEvents(false);
-    textItem_->setAcceptTouchEvents(false);
+    text_ = modelNode->text();
+    staticText_.setText(text_);
+    staticText_.prepare(QTransform(), textFont());
 
     setInletCount(modelNode->inletCount(), true);
     setOutletCount(modelNode->outletCount(), true);
 
     adjust();
 
+    // the position comes from the model, no need to write it back
+    setFlag(ItemSendsGeometryChanges, false);
     setPos(modelNode->pos().x(), modelNode->pos().y());
-}
-
-QDataflowModelNode * QDataflowNode::modelNode() const
-{
-    return modelNode_;
+    setFlag(ItemSendsGeometryChanges, true);
 }
 
 void QDataflowNode::setInletCount(int count, bool skipAdjust)
@@ -461,8 +1296,10 @@ void QDataflowNode::setInletCount(int count, bool skipAdjust)
     {
         QDataflowInlet *lastInlet = inlets_.back();
         for(auto *conn : as_const(lastInlet->connections()))
-            canvas()->scene()->removeItem(conn);
-        canvas()->scene()->removeItem(lastInlet);
+            canvas()->removeConnectionItem(conn);
+        canvas()->inletIndex_.remove(lastInlet);
+        if(hoverIOlet_ == lastInlet)
+            hoverIOlet_ = nullptr;
         inlets_.pop_back();
         delete lastInlet;
     }
@@ -470,15 +1307,11 @@ void QDataflowNode::setInletCount(int count, bool skipAdjust)
     while(inlets_.length() < count)
     {
         int i = inlets_.length();
-        QDataflowInlet *inlet = new QDataflowInlet(this, i);
-        inlet->setParentItem(inputHeader_);
-        inlet->setAcceptTouchEvents(false);
-        inlet->setPos(ioletWidth() / 2 + i * (ioletWidth() + ioletSpacing()), ioletHeight() / 2);
-        inlets_.push_back(inlet);
+        inlets_.push_back(new QDataflowInlet(this, i));
     }
 
     if(!skipAdjust)
-        adjust();
+        adjust(AdjustSize | AdjustIOlets);
 }
 
 void QDataflowNode::setOutletCount(int count, bool skipAdjust)
@@ -487,8 +1320,11 @@ void QDataflowNode::setOutletCount(int count, bool skipAdjust)
     {
         QDataflowOutlet *lastOutlet = outlets_.back();
         for(auto *conn : as_const(lastOutlet->connections()))
-            canvas()->scene()->removeItem(conn);
-        canvas()->scene()->removeItem(lastOutlet);
+            canvas()->removeConnectionItem(conn);
+        if(hoverIOlet_ == lastOutlet)
+            hoverIOlet_ = nullptr;
+        if(dragOutlet_ == lastOutlet)
+            dragOutlet_ = nullptr;
         outlets_.pop_back();
         delete lastOutlet;
     }
@@ -496,37 +1332,57 @@ void QDataflowNode::setOutletCount(int count, bool skipAdjust)
     while(outlets_.length() < count)
     {
         int i = outlets_.length();
-        QDataflowOutlet *outlet = new QDataflowOutlet(this, i);
-        outlet->setParentItem(outputHeader_);
-        outlet->setAcceptTouchEvents(false);
-        outlet->setPos(ioletWidth() / 2 + i * (ioletWidth() + ioletSpacing()), ioletHeight() / 2);
-        outlets_.push_back(outlet);
+        outlets_.push_back(new QDataflowOutlet(this, i));
     }
 
     if(!skipAdjust)
-        adjust();
+        adjust(AdjustSize | AdjustIOlets);
 }
 
 void QDataflowNode::setText(const QString &text)
 {
     if(text == this->text()) return;
 
-    textItem_->setPlainText(text);
+    if(textItem_)
+    {
+        // adjusted through QDataflowCanvas::itemTextEditorTextChange()
+        textItem_->setPlainText(text);
+        return;
+    }
+
+    text_ = text;
+    staticText_.setText(text_);
+    staticText_.prepare(QTransform(), textFont());
+    adjust(AdjustSize);
 }
 
 QString QDataflowNode::text() const
 {
-    return textItem_->document()->toPlainText();
+    if(textItem_)
+        return textItem_->document()->toPlainText();
+    return text_;
+}
+
+QFont QDataflowNode::textFont() const
+{
+    return canvas()->font();
+}
+
+QSizeF QDataflowNode::textSize() const
+{
+    if(textItem_)
+        return textItem_->boundingRect().size();
+    QSizeF sz(staticText_.size().width(), QFontMetricsF(textFont()).height());
+    return sz + QSizeF(2 * textMargin(), 2 * textMargin());
 }
 
 void QDataflowNode::setValid(bool valid)
 {
-    valid_ = valid;
+    if(valid == valid_) return;
 
-    inputHeader_->setVisible(valid);
-    outputHeader_->setVisible(valid);
+    valid_ = valid;
 
-    adjust();
+    adjust(AdjustStyle);
 }
 
 bool QDataflowNode::isValid() const
@@ -536,6 +1392,10 @@ bool QDataflowNode::isValid() const
 
 void QDataflowNode::adjustConnections() const
 {
+    // the stubs leaving the node are drawn with the background
+    if(canvas()->virtualStubNodes_.contains(modelNode()))
+        canvas()->resetCachedContent();
+
     for(auto *inlet : inlets_)
     {
         inlet->adjustConnections();
@@ -549,45 +1409,50 @@ void QDataflowNode::adjustConnections() const
 
 QRectF QDataflowNode::boundingRect() const
 {
-    QRectF r = objectBox_->boundingRect();
-    r.setHeight(r.height() + 2 * ioletHeight());
-    qreal adj = ioletHeight();
-    r.adjust(-adj, -adj, adj, adj);
-    return r;
+    return boundingRect_;
 }
 
-void QDataflowNode::adjust()
+void QDataflowNode::adjust(int flags)
 {
-    QRectF r = textItem_->boundingRect();
-    qreal w = std::max(r.width(), std::max(inletsWidth(), outletsWidth()));
-
-    prepareGeometryChange();
-
-    inputHeader_->setPos(0, 0);
-    objectBox_->setPos(0, ioletHeight());
-    outputHeader_->setPos(0, ioletHeight() + r.height());
-
-    inputHeader_->setRect(0, 0, w, ioletHeight());
-    objectBox_->setRect(0, 0, w, r.height());
-    outputHeader_->setRect(0, 0, w, ioletHeight());
-
-    QPen pen = objectPen();
-    inputHeader_->setPen(pen);
-    objectBox_->setPen(pen);
-    outputHeader_->setPen(pen);
-
-    QBrush ob = objectBrush(), hb = headerBrush();
-
-    objectBox_->setBrush(ob);
-    outputHeader_->setBrush(hb);
-    inputHeader_->setBrush(hb);
+    if(flags & AdjustSize)
+    {
+        QSizeF sz = textSize();
+        qreal w = std::max(sz.width(), std::max(inletsWidth(), outletsWidth()));
+        QRectF r(0, ioletHeight(), w, sz.height());
+        if(r != objectRect_)
+        {
+            prepareGeometryChange();
+            objectRect_ = r;
+            qreal adj = ioletHeight();
+            boundingRect_ = QRectF(0, 0, w, r.height() + 2 * ioletHeight()).adjusted(-adj, -adj, adj, adj);
+            // the outlets move with the bottom of the box:
+            flags |= AdjustIOlets;
+        }
+        if(textItem_)
+            textItem_->setPos(objectRect_.topLeft());
+    }
 
-    textItem_->setDefaultTextColor(pen.color());
+    if(flags & AdjustIOlets)
+    {
+        // iolet rectangles are computed here once, and painted in one batch
+        ioletRects_.resize(inletCount() + outletCount());
+        int i = 0;
+        for(auto *inlet : inlets_)
+            ioletRects_[i++] = inlet->rect_ = inlet->computeRect();
+        for(auto *outlet : outlets_)
+            ioletRects_[i++] = outlet->rect_ = outlet->computeRect();
+
+        canvas()->updateNodeIndex(this);
+        adjustConnections();
+    }
 
-    inputHeader_->setVisible(isValid());
-    outputHeader_->setVisible(isValid());
+    if(flags & AdjustStyle)
+    {
+        if(textItem_)
+            textItem_->setDefaultTextColor(objectPen().color());
+    }
 
-    adjustConnections();
+    update();
 }
 
 qreal QDataflowNode::inletsWidth() const
@@ -600,34 +1465,58 @@ qreal QDataflowNode::outletsWidth() const
     return outletCount() * (ioletWidth() + ioletSpacing()) - ioletSpacing();
 }
 
+QRectF QDataflowNode::inputHeaderRect() const
+{
+    return QRectF(0, 0, objectRect_.width(), ioletHeight());
+}
+
+QRectF QDataflowNode::outputHeaderRect() const
+{
+    return QRectF(0, objectRect_.bottom(), objectRect_.width(), ioletHeight());
+}
+
+QDataflowIOlet * QDataflowNode::ioletAt(const QPointF &pos) const
+{
+    if(!isValid()) return nullptr;
+
+    // iolets are evenly spaced, and their hit rectangles do not overlap:
+    int i = qFloor((pos.x() + ioletSpacing() / 2) / (ioletWidth() + ioletSpacing()));
+    if(i < 0) return nullptr;
+    if(i < inletCount() && inlets_[i]->hitRect().contains(pos))
+        return inlets_[i];
+    if(i < outletCount() && outlets_[i]->hitRect().contains(pos))
+        return outlets_[i];
+    return nullptr;
+}
+
 QPen QDataflowNode::objectPen() const
 {
-    return QPen(isSelected() ? Qt::blue : Qt::black, 1, isValid() ? Qt::SolidLine : Qt::DashLine);
+    return canvas()->style_.objectPen[isSelected()][isValid()];
 }
 
 QBrush QDataflowNode::objectBrush() const
 {
-    return Qt::white;
+    return canvas()->style_.objectBrush;
 }
 
 QBrush QDataflowNode::headerBrush() const
 {
-    return Qt::lightGray;
+    return canvas()->style_.headerBrush;
 }
 
 QPen QDataflowNode::tempConnectionPen() const
 {
-    return QPen(Qt::gray, 1, Qt::DashLine, Qt::RoundCap, Qt::RoundJoin);
+    return canvas()->style_.tempConnectionPen;
 }
 
 QPen QDataflowNode::connectionPen() const
 {
-    return QPen(Qt::black, 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
+    return canvas()->style_.connectionPen[0];
 }
 
 QPen QDataflowNode::invalidConnectionPen() const
 {
-    return QPen(Qt::red, 1, Qt::DashLine, Qt::RoundCap, Qt::RoundJoin);
+    return canvas()->style_.invalidConnectionPen;
 }
 
 void QDataflowNode::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
@@ -638,14 +1527,51 @@ void QDataflowNode::paint(QPainter *painter, const QStyleOptionGraphicsItem *opt
 
     if(sel || hov)
     {
-        painter->fillRect(boundingRect(), sel ? Qt::cyan : Qt::gray);
+        painter->fillRect(boundingRect(), sel ? Qt::cyan : Qt::gray);
+    }
+
+    painter->setPen(objectPen());
+    if(isValid())
+    {
+        painter->setBrush(headerBrush());
+        painter->drawRect(inputHeaderRect());
+        painter->drawRect(outputHeaderRect());
+    }
+    painter->setBrush(objectBrush());
+    painter->drawRect(objectRect_);
+
+    // text is unreadable when zoomed out; in edit mode the text item draws it
+    qreal lod = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    if(!textItem_ && lod >= canvas()->textDetailThreshold())
+    {
+        painter->setFont(textFont());
+        painter->setPen(objectPen().color());
+        painter->drawStaticText(objectRect_.topLeft() + QPointF(textMargin(), textMargin()), staticText_);
     }
+
+    if(!isValid() || lod < canvas()->ioletDetailThreshold())
+        return;
+    painter->setPen(Qt::NoPen);
+    painter->setBrush(Qt::black);
+    painter->drawRects(ioletRects_);
 }
 
 void QDataflowNode::enterEditMode()
 {
     oldText_ = text();
     setSelected(true);
+
+    if(!textItem_)
+    {
+        textItem_ = new QDataflowNodeTextLabel(this, this);
+        textItem_->setAcceptTouchEvents(false);
+        textItem_->setFont(textFont());
+        textItem_->document()->setDocumentMargin(textMargin());
+        textItem_->document()->setPlainText(text_);
+        QObject::connect(textItem_->document(), &QTextDocument::contentsChanged, canvas(), &QDataflowCanvas::itemTextEditorTextChange);
+        adjust(AdjustSize | AdjustStyle);
+    }
+
     textItem_->setFlag(QGraphicsItem::ItemIsFocusable, true);
     //textItem_->setTextInteractionFlags(Qt::TextEditable);
     textItem_->setTextInteractionFlags(Qt::TextEditorInteraction);
@@ -655,10 +1581,14 @@ void QDataflowNode::enterEditMode()
     cursor.select(QTextCursor::Document);
     textItem_->setTextCursor(cursor);
     textItem_->complete();
+    canvas()->editNode_ = this;
 }
 
 void QDataflowNode::exitEditMode(bool revertText)
 {
+    if(canvas()->editNode_ == this)
+        canvas()->editNode_ = nullptr;
+    if(!textItem_) return;
     textItem_->clearCompletion();
     if(revertText)
         textItem_->setPlainText(oldText_);
@@ -673,6 +1603,18 @@ void QDataflowNode::exitEditMode(bool revertText)
     textItem_->setTextCursor(cursor);
     textItem_->setFlag(QGraphicsItem::ItemIsFocusable, false);
     textItem_->setTextInteractionFlags(Qt::NoTextInteraction);
+
+    // back to static text; this may run from within the text item's own
+    // event handlers, so it is deleted later
+    text_ = text();
+    staticText_.setText(text_);
+    staticText_.prepare(QTransform(), textFont());
+    QDataflowNodeTextLabel *label = textItem_;
+    textItem_ = nullptr;
+    QObject::disconnect(label->document(), &QTextDocument::contentsChanged, canvas(), &QDataflowCanvas::itemTextEditorTextChange);
+    label->setVisible(false);
+    label->deleteLater();
+    adjust(AdjustSize);
 }
 
 bool QDataflowNode::isInEditMode() const
@@ -693,19 +1635,27 @@ QVariant QDataflowNode::itemChange(GraphicsItemChange change, const QVariant &va
             p.setY(qRound(p.y() / gridSize) * gridSize);
             setPos(p);
         }
+        canvas()->updateNodeIndex(this);
         adjustConnections();
-        modelNode_->setPos(QPoint(pos().x(), pos().y()));
+        if(canvas()->draggingNodes_)
+            canvas()->nodeDragged(this);
+        else
+            modelNode_->setPos(QPoint(pos().x(), pos().y()));
         break;
     case ItemSelectedHasChanged:
         {
-            adjust();
+            adjust(AdjustStyle);
             if(value.toBool())
             {
+                canvas()->selectedNodes_.insert(this);
                 canvas()->raiseItem(this);
                 oldText_ = text();
             }
             else
+            {
+                canvas()->selectedNodes_.remove(this);
                 exitEditMode(false);
+            }
         }
         break;
     default:
@@ -715,162 +1665,198 @@ QVariant QDataflowNode::itemChange(GraphicsItemChange change, const QVariant &va
     return QGraphicsItem::itemChange(change, value);
 }
 
-void QDataflowNode::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
+void QDataflowNode::hoverEnterEvent(QGraphicsSceneHoverEvent *event)
 {
-    if(!isInEditMode())
-    {
-        enterEditMode();
-        return;
-    }
-    event->ignore();
-    QGraphicsItem::mouseDoubleClickEvent(event);
+    // hover events are always on; repaint only if they are shown
+    if(canvas()->showObjectHoverFeedback())
+        QGraphicsItem::hoverEnterEvent(event);
+    hoverMoveEvent(event);
 }
 
-QDataflowIOlet::QDataflowIOlet(QDataflowNode *node, int index)
-    : canvas_(node->canvas()), node_(node), index_(index)
+void QDataflowNode::hoverMoveEvent(QGraphicsSceneHoverEvent *event)
 {
-    setAcceptHoverEvents(canvas_->showIOletTooltips());
-}
+    QDataflowIOlet *iolet = ioletAt(event->pos());
+    if(iolet == hoverIOlet_) return;
+    hoverIOlet_ = iolet;
 
-void QDataflowIOlet::addConnection(QDataflowConnection *connection)
-{
-    connections_ << connection;
-    connection->adjust();
+    if(iolet && canvas()->showIOletTooltips())
+        canvas()->showTooltip(iolet);
+    else
+        canvas()->hideTooltip();
+
+    if(iolet && iolet->type() == QDataflowItemTypeOutlet)
+        setCursor(Qt::CrossCursor);
+    else
+        unsetCursor();
 }
 
-void QDataflowIOlet::removeConnection(QDataflowConnection *connection)
+void QDataflowNode::hoverLeaveEvent(QGraphicsSceneHoverEvent *event)
 {
-    connections_.removeAll(connection);
+    if(canvas()->showObjectHoverFeedback())
+        QGraphicsItem::hoverLeaveEvent(event);
+    if(hoverIOlet_)
+    {
+        hoverIOlet_ = nullptr;
+        canvas()->hideTooltip();
+        unsetCursor();
+    }
 }
 
-QList<QDataflowConnection*> QDataflowIOlet::connections() const
+void QDataflowNode::mousePressEvent(QGraphicsSceneMouseEvent *event)
 {
-    return connections_;
+    QDataflowIOlet *iolet = ioletAt(event->pos());
+    if(iolet && iolet->type() == QDataflowItemTypeOutlet)
+    {
+        // start dragging a new connection:
+        dragOutlet_ = static_cast<QDataflowOutlet*>(iolet);
+        tmpConn_ = new QGraphicsLineItem(this);
+        tmpConn_->setPos(dragOutlet_->pos() + QPointF(0, ioletHeight() / 2));
+        tmpConn_->setPen(tempConnectionPen());
+        tmpConn_->setFlag(ItemStacksBehindParent);
+        canvas()->raiseItem(this);
+        return;
+    }
+
+    canvas()->beginNodeDrag();
+    QGraphicsItem::mousePressEvent(event);
 }
 
-void QDataflowIOlet::adjustConnections() const
+void QDataflowNode::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 {
-    for(auto *conn : connections_)
+    if(!tmpConn_)
     {
-        conn->adjust();
+        QGraphicsItem::mouseMoveEvent(event);
+        return;
     }
+
+    tmpConn_->setLine(QLineF(QPointF(), tmpConn_->mapFromScene(event->scenePos())));
+
+    // give visual feedback about the connection being made:
+    QDataflowInlet *inlet = canvas()->inletAt(event->scenePos());
+    if(!inlet)
+        tmpConn_->setPen(tempConnectionPen());
+    else if(dragOutlet_ && canvas()->canConnect(dragOutlet_, inlet))
+        tmpConn_->setPen(connectionPen());
+    else
+        tmpConn_->setPen(invalidConnectionPen());
 }
 
-void QDataflowIOlet::hoverEnterEvent(QGraphicsSceneHoverEvent *event)
+void QDataflowNode::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
 {
-    Q_UNUSED(event);
+    if(!tmpConn_)
+    {
+        QGraphicsItem::mouseReleaseEvent(event);
+        canvas()->endNodeDrag();
+        return;
+    }
 
-    tooltip_->setVisible(true);
-    QPointF p = tooltip_->mapToScene(QPointF(0,0));
-    tooltip_->setParentItem(nullptr);
-    tooltip_->setPos(p);
+    scene()->removeItem(tmpConn_);
+    delete tmpConn_;
+    tmpConn_ = nullptr;
+
+    QDataflowOutlet *outlet = dragOutlet_;
+    dragOutlet_ = nullptr;
+    if(!outlet) return;
+
+    // the inlet the feedback was given for, see mouseMoveEvent()
+    QDataflowInlet *inlet = canvas()->inletAt(event->scenePos());
+    if(inlet && canvas()->canConnect(outlet, inlet))
+    {
+        canvas()->model()->connect(modelNode(), outlet->index(), inlet->node()->modelNode(), inlet->index());
+    }
 }
 
-void QDataflowIOlet::hoverLeaveEvent(QGraphicsSceneHoverEvent *event)
+void QDataflowNode::ungrabMouseEvent(QEvent *event)
 {
-    Q_UNUSED(event);
+    // the grab can be lost without a release (focus change, popup, ...)
+    canvas()->endNodeDrag();
+    QGraphicsItem::ungrabMouseEvent(event);
+}
 
-    tooltip_->setVisible(false);
-    tooltip_->setParentItem(this);
-    tooltip_->setPos(QPointF(0,0));
+void QDataflowNode::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
+{
+    if(!isInEditMode())
+    {
+        enterEditMode();
+        return;
+    }
+    event->ignore();
+    QGraphicsItem::mouseDoubleClickEvent(event);
 }
 
-QRectF QDataflowIOlet::boundingRect() const
+QDataflowIOlet::QDataflowIOlet(QDataflowNode *node, int index)
+    : canvas_(node->canvas()), node_(node), index_(index)
 {
-    QDataflowNode *n = node();
-    QRectF r(-n->ioletWidth() / 2, -n->ioletHeight() / 2, n->ioletWidth(), n->ioletHeight());
-    int tolerance = 5;
-    r.adjust(-tolerance, -tolerance, tolerance, tolerance);
-    return r;
 }
 
-void QDataflowIOlet::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+QPointF QDataflowIOlet::pos() const
 {
-    Q_UNUSED(option);
-    Q_UNUSED(widget);
     QDataflowNode *n = node();
-    painter->fillRect(QRect(-n->ioletWidth() / 2, -n->ioletHeight() / 2, n->ioletWidth(), n->ioletHeight()), Qt::black);
+    qreal x = n->ioletWidth() / 2 + index() * (n->ioletWidth() + n->ioletSpacing());
+    QRectF header = type() == QDataflowItemTypeInlet ? n->inputHeaderRect() : n->outputHeaderRect();
+    return QPointF(x, header.center().y());
 }
 
-
-QDataflowInlet::QDataflowInlet(QDataflowNode *node, int index)
-    : QDataflowIOlet(node, index)
+QPointF QDataflowIOlet::scenePos() const
 {
-    tooltip_ = new QDataflowTooltip(this, node->modelNode()->inlet(index)->type(), QPointF(0, -20));
-    tooltip_->setZValue(std::numeric_limits<qreal>::max());
-    tooltip_->setVisible(false);
+    return node()->mapToScene(pos());
 }
 
-QDataflowOutlet::QDataflowOutlet(QDataflowNode *node, int index)
-    : QDataflowIOlet(node, index), tmpConn_()
-
+QRectF QDataflowIOlet::computeRect() const
 {
-    tooltip_ = new QDataflowTooltip(this, node->modelNode()->outlet(index)->type(), QPointF(0, 20));
-    tooltip_->setZValue(std::numeric_limits<qreal>::max());
-    tooltip_->setVisible(false);
+    QDataflowNode *n = node();
+    QPointF p = pos();
+    return QRectF(p.x() - n->ioletWidth() / 2, p.y() - n->ioletHeight() / 2, n->ioletWidth(), n->ioletHeight());
+}
 
-    setCursor(Qt::CrossCursor);
-    setAcceptedMouseButtons(Qt::LeftButton);
+QRectF QDataflowIOlet::hitRect() const
+{
+    qreal tolerance = node()->ioletTolerance();
+    return rect_.adjusted(-tolerance, -tolerance, tolerance, tolerance);
 }
 
-void QDataflowOutlet::mousePressEvent(QGraphicsSceneMouseEvent *event)
+QRectF QDataflowIOlet::sceneBoundingRect() const
 {
-    Q_UNUSED(event);
+    return node()->mapRectToScene(hitRect());
+}
 
-    tmpConn_ = new QGraphicsLineItem(this);
-    tmpConn_->setPos(0, node()->ioletHeight() / 2);
-    tmpConn_->setZValue(10000);
-    tmpConn_->setPen(node()->tempConnectionPen());
-    tmpConn_->setFlag(ItemStacksBehindParent);
-    node()->canvas()->raiseItem(tmpConn_);
-    node()->canvas()->raiseItem(node());
+bool QDataflowIOlet::isVisible() const
+{
+    return node()->isVisible() && node()->isValid();
 }
 
-void QDataflowOutlet::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
+void QDataflowIOlet::addConnection(QDataflowConnection *connection)
 {
-    Q_UNUSED(event);
+    connections_ << connection;
+    connection->adjust();
+}
 
-    setCursor(Qt::CrossCursor);
+void QDataflowIOlet::removeConnection(QDataflowConnection *connection)
+{
+    connections_.removeAll(connection);
+}
 
-    if(tmpConn_)
-    {
-        node()->scene()->removeItem(tmpConn_);
-        delete tmpConn_;
-        tmpConn_ = 0;
-    }
+QList<QDataflowConnection*> QDataflowIOlet::connections() const
+{
+    return connections_;
+}
 
-    if(QDataflowInlet *inlet = node()->canvas()->itemAtT<QDataflowInlet>(event->scenePos()))
+void QDataflowIOlet::adjustConnections() const
+{
+    for(auto *conn : connections_)
     {
-        QDataflowModel *model = node()->canvas()->model();
-        model->connect(node()->modelNode(), index(), inlet->node()->modelNode(), inlet->index());
+        canvas_->scheduleConnectionAdjust(conn);
     }
 }
 
-void QDataflowOutlet::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
+QDataflowInlet::QDataflowInlet(QDataflowNode *node, int index)
+    : QDataflowIOlet(node, index)
 {
-    if(tmpConn_)
-    {
-        tmpConn_->setLine(QLineF(QPointF(), tmpConn_->mapFromScene(event->scenePos())));
-
-        // inlet under mouse:
-        QDataflowInlet *inlet = node()->canvas()->itemAtT<QDataflowInlet>(event->scenePos());
+}
 
-        // give visual feedback about the connection being made:
-        QDataflowModelOutlet *mdloutlet = node()->modelNode()->outlet(index());
-        QDataflowModelInlet *mdlinlet = inlet ? inlet->node()->modelNode()->inlet(inlet->index()) : nullptr;
-        if(inlet && mdloutlet->canMakeConnectionTo(mdlinlet) && mdlinlet->canAcceptConnectionFrom(mdloutlet))
-        {
-            tmpConn_->setPen(node()->connectionPen());
-        }
-        else if(inlet)
-        {
-            tmpConn_->setPen(node()->invalidConnectionPen());
-        }
-        else
-        {
-            tmpConn_->setPen(node()->tempConnectionPen());
-        }
-    }
+QDataflowOutlet::QDataflowOutlet(QDataflowNode *node, int index)
+    : QDataflowIOlet(node, index)
+{
 }
 
 QDataflowConnection::QDataflowConnection(QDataflowCanvas *canvas, QDataflowModelConnection *modelConnection)
@@ -899,10 +1885,41 @@ void QDataflowConnection::adjust()
     if(!source_ || !dest_)
         return;
 
+    QLineF line = endpoints();
+    if(!shape_.isEmpty() && line.p1() == sourcePoint_ && line.p2() == destPoint_)
+        return;
+
     prepareGeometryChange();
 
-    sourcePoint_ = mapFromItem(source_, 0, source_->node()->ioletHeight() / 2);
-    destPoint_ = mapFromItem(dest_, 0, -dest_->node()->ioletHeight() / 2);
+    sourcePoint_ = line.p1();
+    destPoint_ = line.p2();
+
+    // the shape is the segment widened by k on both sides, along its normal:
+    QPointF dp = destPoint_ - sourcePoint_;
+    qreal len = std::sqrt(QPointF::dotProduct(dp, dp));
+    QPointF a = len > 0 ? QPointF(-dp.y(), dp.x()) / len : QPointF(0, 1);
+    qreal k = source_->node()->ioletHeight();
+    shape_ = QPainterPath();
+    shape_.addPolygon(QPolygonF()
+                      << (sourcePoint_ + k * a)
+                      << (destPoint_ + k * a)
+                      << (destPoint_ - k * a)
+                      << (sourcePoint_ - k * a));
+
+    qreal penWidth = 2;
+    qreal extra = penWidth / 2.0;
+    boundingRect_ = QRectF(sourcePoint_, destPoint_).normalized()
+        .adjusted(-extra, -extra, extra, extra)
+        .united(shape_.boundingRect());
+
+    if(canvas_->connectionLayer_)
+        canvas_->connectionLayer_->updateConnection(this);
+}
+
+QLineF QDataflowConnection::endpoints() const
+{
+    return QLineF(mapFromScene(source_->scenePos() + QPointF(0, source_->node()->ioletHeight() / 2)),
+                  mapFromScene(dest_->scenePos() - QPointF(0, dest_->node()->ioletHeight() / 2)));
 }
 
 QRectF QDataflowConnection::boundingRect() const
@@ -910,27 +1927,25 @@ QRectF QDataflowConnection::boundingRect() const
     if(!source_ || !dest_)
         return QRectF();
 
-    qreal penWidth = 1;
-    qreal extra = (penWidth) / 2.0;
+    return boundingRect_;
+}
+
+QVariant QDataflowConnection::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+    if(change == ItemSelectedHasChanged)
+    {
+        if(value.toBool())
+            canvas_->selectedConnections_.insert(this);
+        else
+            canvas_->selectedConnections_.remove(this);
+    }
 
-    return QRectF(sourcePoint_, destPoint_).normalized()
-        .adjusted(-extra, -extra, extra, extra);
+    return QGraphicsItem::itemChange(change, value);
 }
 
 QPainterPath QDataflowConnection::shape() const
 {
-    QPointF dp = destPoint_ - sourcePoint_;
-    qreal angle = atan2(dp.y(), dp.x());
-    QPointF a(cos(angle + M_PI_2), sin(angle + M_PI_2)),
-            b(cos(angle - M_PI_2), sin(angle - M_PI_2));
-    int k = source_->node()->ioletHeight();
-    QPainterPath path;
-    path.addPolygon(QPolygonF()
-                    << (sourcePoint_ + k * a)
-                    << (destPoint_ + k * a)
-                    << (destPoint_ + k * b)
-                    << (sourcePoint_ + k * b));
-    return path;
+    return shape_;
 }
 
 void QDataflowConnection::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
@@ -945,17 +1960,210 @@ void QDataflowConnection::paint(QPainter *painter, const QStyleOptionGraphicsIte
     bool sel = option->state & QStyle::State_Selected,
             hov = option->state & QStyle::State_MouseOver;
 
+    // zoomed out: a thin cosmetic line, without hover/selection fill
+    if(QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform()) < canvas()->connectionDetailThreshold())
+    {
+        painter->setPen(canvas_->style_.thinConnectionPen[sel]);
+        painter->drawLine(line);
+        return;
+    }
+
     if(sel || hov)
     {
-        painter->fillPath(shape(), sel ? Qt::cyan : Qt::gray);
+        painter->fillPath(shape_, sel ? Qt::cyan : Qt::gray);
     }
 
-    painter->setPen(QPen(sel ? Qt::blue : Qt::black, 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+    painter->setPen(canvas_->style_.connectionPen[sel]);
     painter->drawLine(line);
 }
 
+static qreal distanceToSegment(const QPointF &p, const QPointF &a, const QPointF &b)
+{
+    QPointF ab = b - a, ap = p - a;
+    qreal len2 = QPointF::dotProduct(ab, ab);
+    qreal t = len2 > 0 ? qBound(qreal(0), QPointF::dotProduct(ap, ab) / len2, qreal(1)) : qreal(0);
+    QPointF d = ap - t * ab;
+    return std::sqrt(QPointF::dotProduct(d, d));
+}
+
+static bool segmentIntersectsRect(const QPointF &a, const QPointF &b, const QRectF &r)
+{
+    // Liang-Barsky clipping of the segment against the rectangle
+    const qreal dx = b.x() - a.x(), dy = b.y() - a.y();
+    const qreal p[4] = {-dx, dx, -dy, dy};
+    const qreal q[4] = {a.x() - r.left(), r.right() - a.x(), a.y() - r.top(), r.bottom() - a.y()};
+    qreal t0 = 0, t1 = 1;
+    for(int i = 0; i < 4; i++)
+    {
+        if(p[i] == 0)
+        {
+            if(q[i] < 0) return false;
+            continue;
+        }
+        qreal t = q[i] / p[i];
+        if(p[i] < 0) t0 = std::max(t0, t);
+        else t1 = std::min(t1, t);
+        if(t0 > t1) return false;
+    }
+    return true;
+}
+
+QDataflowConnectionLayer::QDataflowConnectionLayer(QDataflowCanvas *canvas)
+    : canvas_(canvas), boundsDirty_(false)
+{
+    setFlag(ItemUsesExtendedStyleOption);
+    // clicks are handled by QDataflowCanvas::mousePressEvent()
+    setAcceptedMouseButtons(Qt::NoButton);
+    setAcceptTouchEvents(false);
+    setZValue(-1);
+}
+
+void QDataflowConnectionLayer::addConnection(QDataflowConnection *conn)
+{
+    QRectF r = connectionRect(conn);
+    index_.update(conn, r);
+    if(!bounds_.contains(r))
+    {
+        prepareGeometryChange();
+        bounds_ = bounds_.united(r);
+    }
+    update(r);
+}
+
+void QDataflowConnectionLayer::removeConnection(QDataflowConnection *conn)
+{
+    if(!index_.contains(conn)) return;
+    QRectF r = index_.rect(conn);
+    update(r);
+    index_.remove(conn);
+    if(touchesBounds(r)) boundsDirty_ = true;
+}
+
+void QDataflowConnectionLayer::updateConnection(QDataflowConnection *conn)
+{
+    if(!index_.contains(conn)) return;
+    QRectF r = index_.rect(conn);
+    update(r);
+    if(touchesBounds(r)) boundsDirty_ = true;
+    addConnection(conn);
+}
+
+void QDataflowConnectionLayer::updateBounds()
+{
+    if(!boundsDirty_) return;
+    boundsDirty_ = false;
+    QRectF bounds = index_.bounds();
+    if(bounds == bounds_) return;
+    prepareGeometryChange();
+    bounds_ = bounds;
+}
+
+bool QDataflowConnectionLayer::hasConnection(QDataflowConnection *conn) const
+{
+    return index_.contains(conn);
+}
+
+QList<QDataflowConnection*> QDataflowConnectionLayer::connections() const
+{
+    QList<QDataflowConnection*> ret;
+    index_.visit(bounds_, [&ret](QDataflowConnection *conn, const QRectF &) {ret.push_back(conn);});
+    return ret;
+}
+
+QDataflowConnection * QDataflowConnectionLayer::connectionAt(const QPointF &pos) const
+{
+    // same half-width as QDataflowConnection::shape()
+    const qreal tolerance = 4;
+    QDataflowConnection *ret = nullptr;
+    qreal retDistance = tolerance;
+    QRectF r(pos - QPointF(tolerance, tolerance), pos + QPointF(tolerance, tolerance));
+    index_.visit(r, [&](QDataflowConnection *conn, const QRectF &) {
+        qreal d = distanceToSegment(pos, conn->sourcePoint_, conn->destPoint_);
+        if(d <= retDistance)
+        {
+            ret = conn;
+            retDistance = d;
+        }
+    });
+    return ret;
+}
+
+void QDataflowConnectionLayer::setConnectionSelected(QDataflowConnection *conn, bool selected)
+{
+    if(conn->isSelected() == selected) return;
+    conn->setSelected(selected);
+    update(index_.rect(conn));
+}
+
+void QDataflowConnectionLayer::selectConnections(const QRectF &rect)
+{
+    for(auto *conn : as_const(canvas_->selectedConnections_.values()))
+    {
+        if(!segmentIntersectsRect(conn->sourcePoint_, conn->destPoint_, rect))
+            setConnectionSelected(conn, false);
+    }
+    index_.visit(rect, [this, &rect](QDataflowConnection *conn, const QRectF &) {
+        if(segmentIntersectsRect(conn->sourcePoint_, conn->destPoint_, rect))
+            setConnectionSelected(conn, true);
+    });
+}
+
+void QDataflowConnectionLayer::clearSelection()
+{
+    for(auto *conn : as_const(canvas_->selectedConnections_.values()))
+        setConnectionSelected(conn, false);
+}
+
+QRectF QDataflowConnectionLayer::boundingRect() const
+{
+    return bounds_;
+}
+
+QPainterPath QDataflowConnectionLayer::shape() const
+{
+    // the layer never collides as a whole (e.g. with the rubber band or
+    // the mouse)
+    return QPainterPath();
+}
+
+void QDataflowConnectionLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
+{
+    const qreal pad = 2;
+    QRectF exposed = option->exposedRect.adjusted(-pad, -pad, pad, pad);
+
+    lines_.clear();
+    selectedLines_.clear();
+    index_.visit(exposed, [this](QDataflowConnection *conn, const QRectF &) {
+        if(conn->sourcePoint_ == conn->destPoint_) return;
+        (conn->isSelected() ? selectedLines_ : lines_).push_back(QLineF(conn->sourcePoint_, conn->destPoint_));
+    });
+
+    bool thin = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform()) < canvas_->connectionDetailThreshold();
+    const QPen *pens = thin ? canvas_->style_.thinConnectionPen : canvas_->style_.connectionPen;
+
+    painter->setPen(pens[0]);
+    painter->drawLines(lines_);
+
+    if(!selectedLines_.isEmpty())
+    {
+        painter->setPen(pens[1]);
+        painter->drawLines(selectedLines_);
+    }
+}
+
+bool QDataflowConnectionLayer::touchesBounds(const QRectF &rect) const
+{
+    return rect.left() <= bounds_.left() || rect.top() <= bounds_.top() ||
+            rect.right() >= bounds_.right() || rect.bottom() >= bounds_.bottom();
+}
+
+QRectF QDataflowConnectionLayer::connectionRect(QDataflowConnection *conn) const
+{
+    return QRectF(conn->sourcePoint_, conn->destPoint_).normalized();
+}
+
 QDataflowNodeTextLabel::QDataflowNodeTextLabel(QDataflowNode *node, QGraphicsItem *parent)
-    : QGraphicsTextItem(parent), node_(node), completionIndex_(-1), completionActive_(false)
+    : QGraphicsTextItem(parent), node_(node), completionIndex_(-1), completionFirstRow_(0), completionActive_(false)
 {
 }
 
@@ -989,55 +2197,58 @@ bool QDataflowNodeTextLabel::sceneEvent(QEvent *event)
     return QGraphicsTextItem::sceneEvent(event);
 }
 
-void QDataflowNodeTextLabel::setCompletion(const QStringList &list)
+bool QDataflowNodeTextLabel::sceneEventFilter(QGraphicsItem *watched, QEvent *event)
 {
-    clearCompletion();
-
-    if(list.empty()) return;
+    Q_UNUSED(watched);
 
-    completionActive_ = true;
+    if(event->type() == QEvent::GraphicsSceneWheel && completionActive_)
+    {
+        QGraphicsSceneWheelEvent *wheelEvent = static_cast<QGraphicsSceneWheelEvent*>(event);
+        scrollCompletion(wheelEvent->delta() > 0 ? -1 : 1);
+        return true;
+    }
+    return false;
+}
 
-    qreal y = boundingRect().height() + 1;
-    for(auto &str : list)
+void QDataflowNodeTextLabel::setCompletion(const QStringList &list)
+{
+    if(list.empty())
     {
-        QGraphicsRectItem *rectItem = new QGraphicsRectItem(this);
-        rectItem->setPos(0, y);
-        QGraphicsSimpleTextItem *item = new QGraphicsSimpleTextItem(rectItem);
-        item->setText(str);
-        completionRectItems_.push_back(rectItem);
-        completionItems_.push_back(item);
-        y += item->boundingRect().height();
+        clearCompletion();
+        return;
     }
-    qreal maxw = 0;
-    for(auto *item : as_const(completionItems_))
-        maxw = std::max(maxw, item->boundingRect().width());
-    for(int i = 0; i < completionItems_.length(); i++)
+
+    // row items are allocated once and recycled; only the visible window
+    // of the candidate list is ever bound to them
+    if(completionRectItems_.isEmpty())
     {
-        QRectF r = completionItems_[i]->boundingRect();
-        r.setWidth(maxw);
-        completionRectItems_[i]->setRect(r);
+        for(int i = 0; i < completionMaxRows(); i++)
+        {
+            QGraphicsRectItem *rectItem = new QGraphicsRectItem(this);
+            rectItem->setVisible(false);
+            if(scene())
+                rectItem->installSceneEventFilter(this);
+            QGraphicsSimpleTextItem *item = new QGraphicsSimpleTextItem(rectItem);
+            completionRectItems_.push_back(rectItem);
+            completionItems_.push_back(item);
+        }
     }
 
-    node_->canvas()->raiseItem(this);
+    completionList_ = list;
+    completionIndex_ = -1;
+    completionFirstRow_ = 0;
+    completionActive_ = true;
 
     updateCompletion();
 }
 
 void QDataflowNodeTextLabel::clearCompletion()
 {
-    for(auto *item : as_const(completionItems_))
-    {
-        node_->canvas()->scene()->removeItem(item);
-        delete item;
-    }
-    completionItems_.clear();
     for(auto *item : as_const(completionRectItems_))
-    {
-        node_->canvas()->scene()->removeItem(item);
-        delete item;
-    }
-    completionRectItems_.clear();
+        item->setVisible(false);
+    completionList_.clear();
     completionIndex_ = -1;
+    completionFirstRow_ = 0;
     completionActive_ = false;
 }
 
@@ -1047,7 +2258,7 @@ void QDataflowNodeTextLabel::acceptCompletion()
     {
         if(completionIndex_ >= 0)
         {
-            document()->setPlainText(completionItems_[completionIndex_]->text());
+            document()->setPlainText(completionList_[completionIndex_]);
         }
         else
         {
@@ -1062,20 +2273,61 @@ void QDataflowNodeTextLabel::acceptCompletion()
 
 void QDataflowNodeTextLabel::cycleCompletion(int d)
 {
-    int n = completionItems_.length();
+    int n = completionList_.length();
     if(completionIndex_ == -1 && d == -1) completionIndex_ = n - 1;
     else completionIndex_ += d;
     while(completionIndex_ < 0) completionIndex_ += n;
     while(completionIndex_ >= n) completionIndex_ -= n;
+
+    // keep the current candidate inside the visible window:
+    if(completionIndex_ < completionFirstRow_)
+        completionFirstRow_ = completionIndex_;
+    else if(completionIndex_ >= completionFirstRow_ + completionMaxRows())
+        completionFirstRow_ = completionIndex_ - completionMaxRows() + 1;
+
+    updateCompletion();
+}
+
+void QDataflowNodeTextLabel::scrollCompletion(int d)
+{
+    int maxFirstRow = std::max(0, completionList_.length() - completionMaxRows());
+    int firstRow = qBound(0, completionFirstRow_ + d, maxFirstRow);
+    if(firstRow == completionFirstRow_) return;
+    completionFirstRow_ = firstRow;
     updateCompletion();
 }
 
 void QDataflowNodeTextLabel::updateCompletion()
 {
-    for(int i = 0; i < completionItems_.length(); i++)
+    int rows = completionActive_ ? std::min(completionMaxRows(), completionList_.length() - completionFirstRow_) : 0;
+
+    qreal maxw = 0;
+    for(int i = 0; i < rows; i++)
+    {
+        const QString &str = completionList_[completionFirstRow_ + i];
+        if(completionItems_[i]->text() != str)
+            completionItems_[i]->setText(str);
+        maxw = std::max(maxw, completionItems_[i]->boundingRect().width());
+    }
+
+    qreal y = boundingRect().height() + 1;
+    for(int i = 0; i < completionRectItems_.length(); i++)
     {
-        completionRectItems_[i]->setBrush(i == completionIndex_ ? Qt::blue : Qt::white);
-        completionItems_[i]->setPen(QPen(i == completionIndex_ ? Qt::white : Qt::black));
+        QGraphicsRectItem *rectItem = completionRectItems_[i];
+        if(i >= rows)
+        {
+            rectItem->setVisible(false);
+            continue;
+        }
+        bool current = completionFirstRow_ + i == completionIndex_;
+        QRectF r = completionItems_[i]->boundingRect();
+        r.setWidth(maxw);
+        rectItem->setPos(0, y);
+        rectItem->setRect(r);
+        rectItem->setBrush(current ? Qt::blue : Qt::white);
+        completionItems_[i]->setPen(QPen(current ? Qt::white : Qt::black));
+        rectItem->setVisible(true);
+        y += r.height();
     }
 }
 
@@ -1107,7 +2359,15 @@ QDataflowTooltip::QDataflowTooltip(QGraphicsItem *parentItem, const QString &tex
 
 void QDataflowTooltip::setText(const QString &text)
 {
+    setText(text, offset_);
+}
+
+void QDataflowTooltip::setText(const QString &text, const QPointF &offset)
+{
+    if(text == text_->text() && offset == offset_) return;
+
     text_->setText(text);
+    offset_ = offset;
 
     adjust();
 }
@@ -1115,6 +2375,17 @@ void QDataflowTooltip::setText(const QString &text)
 void QDataflowTooltip::adjust()
 {
     text_->setPos(offset_ - text_->boundingRect().center());
+
+    // the balloon only depends on the text and the offset, so its path
+    // (which needs a boolean operation) is computed once per combination
+    QString key = QString::number(offset_.x()) + QLatin1Char(',') + QString::number(offset_.y()) + QLatin1Char(':') + text_->text();
+    auto it = pathCache_.constFind(key);
+    if(it != pathCache_.constEnd())
+    {
+        shape_->setPath(*it);
+        return;
+    }
+
     const int kb = 4; // margin
     const int kw = 6; // tip width
     QRectF br = text_->boundingRect().adjusted(-kb, -kb, kb, kb).translated(text_->pos());
@@ -1126,7 +2397,9 @@ void QDataflowTooltip::adjust()
     pTip.closeSubpath();
     QPainterPath pRect;
     pRect.addRoundedRect(br, 1.5 * kb, 1.5 * kb);
-    shape_->setPath(pTip.united(pRect).simplified());
+    QPainterPath path = pTip.united(pRect).simplified();
+    pathCache_.insert(key, path);
+    shape_->setPath(path);
 }
 
 QStringList QDataflowTextCompletion::complete(const QString &nodeText)
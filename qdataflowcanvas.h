@@ -18,26 +18,35 @@
 #ifndef QDATAFLOWCANVAS_H
 #define QDATAFLOWCANVAS_H
 
+#include <QBrush>
+#include <QElapsedTimer>
 #include <QGraphicsItem>
 #include <QGraphicsView>
+#include <QPen>
+#include <QStaticText>
 
 #include "qdataflowmodel.h"
+#include "qdataflowspatialindex.h"
 
 class QDataflowNode;
+class QDataflowIOlet;
 class QDataflowInlet;
 class QDataflowOutlet;
 class QDataflowConnection;
+class QDataflowConnectionLayer;
 class QDataflowTextCompletion;
 class QDataflowNodeTextLabel;
 class QDataflowTooltip;
 class QGraphicsSceneMouseEvent;
 class QMouseEvent;
+class QTimer;
 
 enum QDataflowItemType {
     QDataflowItemTypeNode = QGraphicsItem::UserType + 1,
     QDataflowItemTypeConnection = QGraphicsItem::UserType + 2,
     QDataflowItemTypeInlet = QGraphicsItem::UserType + 3,
-    QDataflowItemTypeOutlet = QGraphicsItem::UserType + 4
+    QDataflowItemTypeOutlet = QGraphicsItem::UserType + 4,
+    QDataflowItemTypeConnectionLayer = QGraphicsItem::UserType + 5
 };
 
 class QDataflowCanvas : public QGraphicsView
@@ -50,8 +59,33 @@ public:
     QDataflowModel * model();
     void setModel(QDataflowModel *model);
 
+    // while many model changes are applied (e.g. loading a patch), defer
+    // scene indexing, scene rect updates and repaints to endBulkUpdate()
+    void beginBulkUpdate();
+    void endBulkUpdate();
+    bool isBulkUpdating() const;
+
+    // when virtualized, only the nodes near the visible area (and up to
+    // virtualNeighbourLimit() of their nearest neighbours) have items; they
+    // are created and recycled while scrolling, and the connections to
+    // nodes without an item are drawn as plain lines
+    bool virtualized();
+    void setVirtualized(bool virtualized);
+    qreal virtualMargin() const {return 400;}
+    int virtualNeighbourLimit() const {return 8;}
+    int nodePoolSize() const {return 256;}
+
     QDataflowNode * node(QDataflowModelNode *node);
     QDataflowConnection * connection(QDataflowModelConnection *conn);
+    // the width of the node's box, estimated when it has no item
+    qreal nodeWidth(QDataflowModelNode *mdlnode) const;
+
+    QDataflowInlet * inletAt(const QPointF &scenePos, QDataflowOutlet *compatibleWith = nullptr) const;
+    // true if the types of outlet and inlet allow a connection
+    bool canConnect(QDataflowOutlet *outlet, QDataflowInlet *inlet) const;
+
+    // the part of the scene shown in the viewport
+    QRectF visibleRect() const;
 
     QList<QDataflowNode*> selectedNodes();
     QList<QDataflowConnection*> selectedConnections();
@@ -73,54 +107,176 @@ public:
     void setGridSize(qreal sz);
     bool drawGrid();
     void setDrawGrid(bool draw);
+    qreal minimumGridSpacing() const {return 5;}
+    int spatialIndexThreshold();
+    void setSpatialIndexThreshold(int count);
+    // the sets of changes queued by other threads are applied in bulk
+    // from this size, and one by one below it
+    int bulkUpdateThreshold();
+    void setBulkUpdateThreshold(int count);
+    QRectF minimumSceneRect() const {return QRectF(0, 0, 200, 200);}
+    qreal sceneRectMargin() const {return 400;}
+    qreal textDetailThreshold();
+    void setTextDetailThreshold(qreal lod);
+    qreal ioletDetailThreshold();
+    void setIOletDetailThreshold(qreal lod);
+    qreal connectionDetailThreshold();
+    void setConnectionDetailThreshold(qreal lod);
+    bool batchedConnections();
+    void setBatchedConnections(bool batched);
+    int dragUpdateInterval();
+    void setDragUpdateInterval(int msec);
+
+Q_SIGNALS:
+    // interim positions of the nodes being dragged, emitted at most every
+    // dragUpdateInterval() ms; the model is updated once, on mouse release
+    void nodesMoving(const QHash<QDataflowModelNode*, QPoint> &positions);
+    void modelChanged(QDataflowModel *model);
+    // emitted when the view is scrolled, zoomed or resized
+    void visibleRectChanged(const QRectF &rect);
 
 protected:
-    template<typename T>
-    T * itemAtT(const QPointF &point);
+    void updateNodeIndex(QDataflowNode *node);
+    void removeNodeIndex(QDataflowNode *node);
+    void updateItemIndexMethod();
+    void removeAllItems();
+    QDataflowNode * materializeNode(QDataflowModelNode *mdlnode);
+    QDataflowConnection * materializeConnection(QDataflowModelConnection *mdlconn);
+    // the connections of the node that have no item yet
+    void materializeConnections(QDataflowModelNode *mdlnode);
+    void releaseNode(QDataflowNode *node);
+    void releaseConnection(QDataflowConnection *conn);
+    QRectF nodesSceneRect();
+    void growSceneRect(const QPointF &pos);
+    void moveNodeItem(QDataflowModelNode *mdlnode, const QPoint &pos);
+    void scheduleConnectionAdjust(QDataflowConnection *conn);
+    void showTooltip(QDataflowIOlet *iolet);
+    void hideTooltip();
+    void beginNodeDrag();
+    void nodeDragged(QDataflowNode *node);
+    void endNodeDrag();
+
+    bool isConnectionShown(QDataflowConnection *conn) const;
+    void removeConnectionItem(QDataflowConnection *conn);
 
     void drawBackground(QPainter *painter, const QRectF &rect) override;
+    void paintEvent(QPaintEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
     void mouseDoubleClickEvent(QMouseEvent *event) override;
     void keyPressEvent(QKeyEvent *event) override;
 
 protected Q_SLOTS:
     void itemTextEditorTextChange();
+    void onRubberBandChanged(QRect rubberBandRect, QPointF fromScenePoint, QPointF toScenePoint);
+    void shrinkSceneRect();
+    void adjustDirtyConnections();
+    void adjustDeferredConnections();
+    void updateVirtualItems();
+    void updateVirtualStubs();
+    void clearVirtualStubs();
     void onNodeAdded(QDataflowModelNode *mdlnode);
     void onNodeRemoved(QDataflowModelNode *mdlnode);
     void onNodeValidChanged(QDataflowModelNode *mdlnode, bool valid);
     void onNodePosChanged(QDataflowModelNode *mdlnode, const QPoint &pos);
+    void onNodesPosChanged(const QList<QDataflowModelNode*> &mdlnodes);
     void onNodeTextChanged(QDataflowModelNode *mdlnode, const QString &text);
     void onNodeInletCountChanged(QDataflowModelNode *mdlnode, int count);
     void onNodeOutletCountChanged(QDataflowModelNode *mdlnode, int count);
     void onConnectionAdded(QDataflowModelConnection *mdlconn);
     void onConnectionRemoved(QDataflowModelConnection *mdlconn);
+    void onChangesAboutToBeApplied(int count);
+    void onChangesApplied();
 
     friend class QDataflowNode;
     friend class QDataflowIOlet;
     friend class QDataflowInlet;
     friend class QDataflowOutlet;
     friend class QDataflowConnection;
+    friend class QDataflowConnectionLayer;
 
 private:
     QDataflowModel *model_;
     QDataflowTextCompletion *completion_;
-    QSet<QDataflowNode*> ownedNodes_;
-    QSet<QDataflowConnection*> ownedConnections_;
-    QMap<QDataflowModelNode*, QDataflowNode*> nodes_;
-    QMap<QDataflowModelConnection*, QDataflowConnection*> connections_;
+    QHash<QDataflowModelNode*, QDataflowNode*> nodes_;
+    QHash<QDataflowModelConnection*, QDataflowConnection*> connections_;
+    QSet<QDataflowNode*> selectedNodes_;
+    QSet<QDataflowConnection*> selectedConnections_;
+    QDataflowNode *editNode_;
     bool showIOletsTooltips_;
     bool showObjectHoverFeedback_;
     bool showConnectionHoverFeedback_;
     qreal gridSize_;
     bool drawGrid_;
+    QVector<QPointF> gridPoints_;
+    int spatialIndexThreshold_;
+    QDataflowGridIndex<QDataflowNode*> nodeIndex_;
+    QDataflowGridIndex<QDataflowInlet*> inletIndex_;
+    qreal textDetailThreshold_;
+    qreal ioletDetailThreshold_;
+    qreal connectionDetailThreshold_;
+    QDataflowConnectionLayer *connectionLayer_;
+    QTimer *sceneRectTimer_;
+    QSet<QDataflowConnection*> dirtyConnections_;
+    QRectF dirtyConnectionsVisibleRect_;
+    QTimer *connectionsTimer_;
+    QTimer *deferredConnectionsTimer_;
+    bool draggingNodes_;
+    int dragUpdateInterval_;
+    QElapsedTimer dragUpdateTimer_;
+    QHash<QDataflowModelNode*, QPoint> draggedPositions_;
+    QHash<QDataflowModelNode*, QPoint> dragUpdates_;
+    qreal topZValue_;
+    QDataflowTooltip *tooltip_;
+    int bulkUpdate_;
+    int bulkUpdateThreshold_;
+    bool bulkChanges_;
+    ViewportUpdateMode bulkViewportUpdateMode_;
+    bool virtualized_;
+    QRectF virtualRect_;
+    QRectF lastVisibleRect_;
+    QTimer *virtualTimer_;
+    QList<QDataflowNode*> nodePool_;
+
+    // when virtualized, the connections from an item to a node without one
+    // are drawn by drawBackground()
+    struct VirtualStub
+    {
+        QDataflowModelNode *node; // the end with an item
+        int index;
+        bool fromOutlet;
+        QPointF farPos;
+    };
+    QHash<QDataflowModelConnection*, VirtualStub> virtualStubs_;
+    QSet<QDataflowModelNode*> virtualStubNodes_;
+    QVector<QLineF> stubLines_;
+
+    // pens and brushes are built once and shared by all the items:
+    struct Style
+    {
+        Style();
+        QPen objectPen[2][2]; // [selected][valid]
+        QBrush objectBrush;
+        QBrush headerBrush;
+        QPen connectionPen[2]; // [selected]
+        QPen thinConnectionPen[2]; // [selected], cosmetic
+        QPen tempConnectionPen;
+        QPen invalidConnectionPen;
+    } style_;
 };
 
+// A node paints its headers, body and iolets itself, and hit-tests the
+// iolets geometrically; the text label is its only child item.
 class QDataflowNode : public QGraphicsItem
 {
 protected:
     QDataflowNode(QDataflowCanvas *canvas_, QDataflowModelNode *modelNode);
 
 public:
+    ~QDataflowNode() override;
+
     QDataflowModelNode * modelNode() const;
+    // also used to recycle the item for another model node
+    void setModelNode(QDataflowModelNode *modelNode);
 
     QDataflowInlet * inlet(int index) const {return inlets_.at(index);}
     int inletCount() const {return inlets_.size();}
@@ -129,10 +285,16 @@ public:
     int outletCount() const {return outlets_.size();}
     void setOutletCount(int count, bool skipAdjust = false);
 
-    int type() const override {return QDataflowItemTypeNode;}
+    QDataflowIOlet * ioletAt(const QPointF &pos) const;
+
+    enum {Type = QDataflowItemTypeNode};
+    int type() const override {return Type;}
 
     void setText(const QString &text);
     QString text() const;
+    QFont textFont() const;
+    QSizeF textSize() const;
+    qreal textMargin() const {return 4;}
 
     void setValid(bool valid);
     bool isValid() const;
@@ -141,15 +303,26 @@ public:
 
     QRectF boundingRect() const override;
 
-    void adjust();
+    // what adjust() has to recompute:
+    enum AdjustFlag {
+        AdjustSize = 0x1,   // the box size (text or iolet count changed)
+        AdjustIOlets = 0x2, // iolet positions, index and connections
+        AdjustStyle = 0x4,  // pens and visibility (selection, validity)
+        AdjustAll = AdjustSize | AdjustIOlets | AdjustStyle
+    };
+    void adjust(int flags = AdjustAll);
 
     QDataflowCanvas * canvas() const {return canvas_;}
 
     qreal ioletWidth() const {return 10;}
     qreal ioletHeight() const {return 4;}
     qreal ioletSpacing() const {return 13;}
+    qreal ioletTolerance() const {return 5;}
     qreal inletsWidth() const;
     qreal outletsWidth() const;
+    QRectF inputHeaderRect() const;
+    QRectF objectRect() const {return objectRect_;}
+    QRectF outputHeaderRect() const;
     QPen objectPen() const;
     QBrush objectBrush() const;
     QBrush headerBrush() const;
@@ -166,32 +339,56 @@ public:
 protected:
     QVariant itemChange(GraphicsItemChange change, const QVariant &value) override;
 
+    void hoverEnterEvent(QGraphicsSceneHoverEvent *event) override;
+    void hoverMoveEvent(QGraphicsSceneHoverEvent *event) override;
+    void hoverLeaveEvent(QGraphicsSceneHoverEvent *event) override;
+    void mousePressEvent(QGraphicsSceneMouseEvent *event) override;
+    void mouseMoveEvent(QGraphicsSceneMouseEvent *event) override;
+    void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override;
     void mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event) override;
+    void ungrabMouseEvent(QEvent *event) override;
 
 private:
     QDataflowCanvas *canvas_;
     QDataflowModelNode *modelNode_;
     QList<QDataflowInlet*> inlets_;
     QList<QDataflowOutlet*> outlets_;
-    QGraphicsRectItem *inputHeader_;
-    QGraphicsRectItem *objectBox_;
-    QGraphicsRectItem *outputHeader_;
+    QRectF objectRect_;
+    QRectF boundingRect_;
+    QVector<QRectF> ioletRects_;
+    QString text_;
+    QStaticText staticText_;
     QDataflowNodeTextLabel *textItem_;
     bool valid_;
     QString oldText_;
+    QDataflowIOlet *hoverIOlet_;
+    QDataflowOutlet *dragOutlet_;
+    QGraphicsLineItem *tmpConn_;
 
     friend class QDataflowCanvas;
 };
 
-class QDataflowIOlet : public QGraphicsItem
+// Iolets are not scene items: their owning node paints and hit-tests them.
+class QDataflowIOlet
 {
 protected:
     QDataflowIOlet(QDataflowNode *node, int index);
 
 public:
+    virtual ~QDataflowIOlet() = default;
+
+    virtual int type() const = 0;
+
     QDataflowNode * node() const {return node_;}
     int index() const {return index_;}
 
+    QPointF pos() const;
+    QPointF scenePos() const;
+    QRectF rect() const {return rect_;}
+    QRectF hitRect() const;
+    QRectF sceneBoundingRect() const;
+    bool isVisible() const;
+
     void addConnection(QDataflowConnection *connection);
     void removeConnection(QDataflowConnection *connection);
     QList<QDataflowConnection*> connections() const;
@@ -200,20 +397,14 @@ public:
     QDataflowCanvas * canvas() const {return canvas_;}
 
 protected:
-    void hoverEnterEvent(QGraphicsSceneHoverEvent *event) override;
-    void hoverLeaveEvent(QGraphicsSceneHoverEvent *event) override;
-
-    QRectF boundingRect() const override;
-    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+    QRectF computeRect() const;
 
 private:
     QDataflowCanvas *canvas_;
     QList<QDataflowConnection*> connections_;
     QDataflowNode *node_;
     int index_;
-
-protected:
-    QDataflowTooltip *tooltip_;
+    QRectF rect_;
 
     friend class QDataflowCanvas;
     friend class QDataflowNode;
@@ -241,14 +432,6 @@ protected:
 public:
     int type() const override {return QDataflowItemTypeOutlet;}
 
-protected:
-    void mousePressEvent(QGraphicsSceneMouseEvent *event) override;
-    void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override;
-    void mouseMoveEvent(QGraphicsSceneMouseEvent *event) override;
-
-private:
-    QGraphicsLineItem *tmpConn_;
-
     friend class QDataflowCanvas;
     friend class QDataflowNode;
 };
@@ -265,15 +448,19 @@ public:
     QDataflowInlet * dest() const {return dest_;}
 
     void adjust();
+    QLineF endpoints() const;
 
     QDataflowCanvas * canvas() const {return canvas_;}
 
-    int type() const override {return QDataflowItemTypeConnection;}
+    enum {Type = QDataflowItemTypeConnection};
+    int type() const override {return Type;}
 
 protected:
     QRectF boundingRect() const override;
     QPainterPath shape() const override;
 
+    QVariant itemChange(GraphicsItemChange change, const QVariant &value) override;
+
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
 
 private:
@@ -283,10 +470,60 @@ private:
     QDataflowInlet *dest_;
     QPointF sourcePoint_;
     QPointF destPoint_;
+    QPainterPath shape_;
+    QRectF boundingRect_;
 
     friend class QDataflowCanvas;
     friend class QDataflowInlet;
     friend class QDataflowOutlet;
+    friend class QDataflowConnectionLayer;
+};
+
+// Draws all the connections of a canvas as a single item (see
+// QDataflowCanvas::setBatchedConnections()). The connection items are kept
+// out of the scene; this layer indexes, paints, hit-tests and selects them.
+class QDataflowConnectionLayer : public QGraphicsItem
+{
+protected:
+    QDataflowConnectionLayer(QDataflowCanvas *canvas);
+
+public:
+    enum {Type = QDataflowItemTypeConnectionLayer};
+    int type() const override {return Type;}
+
+    QDataflowCanvas * canvas() const {return canvas_;}
+
+    void addConnection(QDataflowConnection *conn);
+    void removeConnection(QDataflowConnection *conn);
+    void updateConnection(QDataflowConnection *conn);
+    // shrinks the bounds after connections were removed or moved
+    void updateBounds();
+    bool hasConnection(QDataflowConnection *conn) const;
+    QList<QDataflowConnection*> connections() const;
+
+    QDataflowConnection * connectionAt(const QPointF &pos) const;
+    void setConnectionSelected(QDataflowConnection *conn, bool selected);
+    void selectConnections(const QRectF &rect);
+    void clearSelection();
+
+    QRectF boundingRect() const override;
+    QPainterPath shape() const override;
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+protected:
+    QRectF connectionRect(QDataflowConnection *conn) const;
+    bool touchesBounds(const QRectF &rect) const;
+
+private:
+    QDataflowCanvas *canvas_;
+    QDataflowGridIndex<QDataflowConnection*> index_;
+    QRectF bounds_;
+    bool boundsDirty_;
+    QVector<QLineF> lines_;
+    QVector<QLineF> selectedLines_;
+
+    friend class QDataflowCanvas;
 };
 
 class QDataflowNodeTextLabel : public QGraphicsTextItem
@@ -299,18 +536,24 @@ public:
     void clearCompletion();
     void acceptCompletion();
     void cycleCompletion(int d);
+    void scrollCompletion(int d);
     void updateCompletion();
     void complete();
 
+    int completionMaxRows() const {return 8;}
+
 protected:
     bool sceneEvent(QEvent *event) override;
+    bool sceneEventFilter(QGraphicsItem *watched, QEvent *event) override;
     void focusOutEvent(QFocusEvent *event) override;
 
 private:
     QDataflowNode *node_;
+    QStringList completionList_;
     QList<QGraphicsSimpleTextItem*> completionItems_;
     QList<QGraphicsRectItem*> completionRectItems_;
     int completionIndex_;
+    int completionFirstRow_;
     bool completionActive_;
 
     friend class QDataflowNode;
@@ -323,12 +566,14 @@ protected:
 
 public:
     void setText(const QString &text);
+    void setText(const QString &text, const QPointF &offset);
     void adjust();
 
 private:
     QGraphicsSimpleTextItem *text_;
     QGraphicsPathItem *shape_;
     QPointF offset_;
+    QHash<QString, QPainterPath> pathCache_;
 
     friend class QDataflowCanvas;
     friend class QDataflowInlet;
@@ -342,17 +587,4 @@ public:
     virtual ~QDataflowTextCompletion() = default;
 };
 
-template<typename T>
-T * QDataflowCanvas::itemAtT(const QPointF &point)
-{
-    auto const items = scene()->items(point, Qt::IntersectsItemShape, Qt::DescendingOrder, transform());
-    for(QGraphicsItem *item : items)
-    {
-         if(T *itemT = dynamic_cast<T*>(item))
-             return itemT;
-    }
-    return {};
-}
-
-
 #endif // QDATAFLOWCANVAS_H
@@ -0,0 +1,510 @@
+/* QDataflowCanvas - a dataflow widget for Qt
+ * Copyright (C) 2017-2018 Federico Ferri
+ * Copyright (C) 2018 Kuba Ober
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qdataflowlayout.h"
+#include "qdataflowmodel.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <QHash>
+#include <QPair>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
+
+// calls f(i) for every i in [0, count), in parallel chunks; by default
+// chunks are large, as below a few thousand cheap items the thread pool
+// costs more than it saves
+template<typename F>
+static void parallelFor(int count, F f, int chunk = 4096)
+{
+    if(count <= chunk)
+    {
+        for(int i = 0; i < count; i++)
+            f(i);
+        return;
+    }
+    QVector<int> starts;
+    for(int i = 0; i < count; i += chunk)
+        starts.push_back(i);
+    QtConcurrent::blockingMap(starts, [&](int &start) {
+        const int end = std::min(start + chunk, count);
+        for(int i = start; i < end; i++)
+            f(i);
+    });
+}
+
+QDataflowLayout::QDataflowLayout(QDataflowModel *model, QObject *parent)
+    : QObject(parent), model_(model)
+{
+    settings_.algorithm = Layered;
+    settings_.nodeSpacing = 80;
+    settings_.layerSpacing = 60;
+    settings_.iterations = 24;
+
+    QObject::connect(&watcher_, &QFutureWatcher<QVector<QPointF>>::finished, this, &QDataflowLayout::onFinished);
+}
+
+QDataflowLayout::~QDataflowLayout()
+{
+    cancel();
+    watcher_.waitForFinished();
+}
+
+QDataflowModel * QDataflowLayout::model()
+{
+    return model_;
+}
+
+QDataflowLayout::Algorithm QDataflowLayout::algorithm()
+{
+    return settings_.algorithm;
+}
+
+void QDataflowLayout::setAlgorithm(Algorithm algorithm)
+{
+    settings_.algorithm = algorithm;
+}
+
+qreal QDataflowLayout::nodeSpacing()
+{
+    return settings_.nodeSpacing;
+}
+
+void QDataflowLayout::setNodeSpacing(qreal spacing)
+{
+    settings_.nodeSpacing = qMax(qreal(1), spacing);
+}
+
+qreal QDataflowLayout::layerSpacing()
+{
+    return settings_.layerSpacing;
+}
+
+void QDataflowLayout::setNodeWidth(const std::function<qreal(QDataflowModelNode*)> &nodeWidth)
+{
+    nodeWidth_ = nodeWidth;
+}
+
+void QDataflowLayout::setLayerSpacing(qreal spacing)
+{
+    settings_.layerSpacing = qMax(qreal(1), spacing);
+}
+
+int QDataflowLayout::iterations()
+{
+    return settings_.iterations;
+}
+
+void QDataflowLayout::setIterations(int count)
+{
+    settings_.iterations = qMax(0, count);
+}
+
+bool QDataflowLayout::isRunning() const
+{
+    return watcher_.isRunning();
+}
+
+void QDataflowLayout::start()
+{
+    if(isRunning() || !model_) return;
+
+    // the worker only sees this copy, never the model:
+    nodes_.clear();
+    QHash<QDataflowModelNode*, int> index;
+    for(auto *node : as_const(model_->nodes()))
+    {
+        index.insert(node, nodes_.size());
+        nodes_.push_back(node);
+    }
+
+    Graph graph;
+    const int n = nodes_.size();
+    graph.pos.resize(n);
+    graph.width.resize(n);
+    graph.out.resize(n);
+    graph.in.resize(n);
+    for(int i = 0; i < n; i++)
+    {
+        graph.pos[i] = nodes_[i]->pos();
+        graph.width[i] = nodeWidth_ ? nodeWidth_(nodes_[i]) : estimateNodeWidth(nodes_[i]);
+        for(auto *outlet : as_const(nodes_[i]->outlets()))
+        {
+            for(auto *conn : as_const(outlet->connections()))
+            {
+                int j = index.value(conn->dest()->node(), -1);
+                if(j < 0 || j == i || graph.out[i].contains(j)) continue;
+                graph.out[i].push_back(j);
+                graph.in[j].push_back(i);
+            }
+        }
+    }
+
+    canceled_.store(0);
+    const Settings settings = settings_;
+    const QAtomicInt *canceled = &canceled_;
+    watcher_.setFuture(QtConcurrent::run([graph, settings, canceled]() -> QVector<QPointF> {
+        if(settings.algorithm == ForceDirected)
+            return forceDirected(graph, settings, *canceled);
+        return layered(graph, settings, *canceled);
+    }));
+}
+
+void QDataflowLayout::cancel()
+{
+    canceled_.store(1);
+}
+
+void QDataflowLayout::onFinished()
+{
+    QVector<QPointF> result = watcher_.result();
+    if(canceled_.load() || !model_ || result.size() != nodes_.size())
+    {
+        nodes_.clear();
+        Q_EMIT finished();
+        return;
+    }
+
+    // nodes removed while the layout was running are skipped
+    QSet<QDataflowModelNode*> current = model_->nodes();
+    QHash<QDataflowModelNode*, QPoint> positions;
+    positions.reserve(nodes_.size());
+    for(int i = 0; i < nodes_.size(); i++)
+        if(current.contains(nodes_[i]))
+            positions.insert(nodes_[i], result[i].toPoint());
+    nodes_.clear();
+
+    model_->setNodesPos(positions);
+    Q_EMIT finished();
+}
+
+qreal QDataflowLayout::estimateNodeWidth(QDataflowModelNode *node)
+{
+    // roughly what the canvas draws with its default font and iolets
+    const qreal textWidth = 7 * node->text().length() + 8;
+    const int iolets = std::max(node->inletCount(), node->outletCount());
+    return std::max(textWidth, qreal(iolets * 23 - 13));
+}
+
+QVector<QPointF> QDataflowLayout::layered(const Graph &graph, const Settings &settings, const QAtomicInt &canceled)
+{
+    const int n = graph.pos.size();
+    if(n == 0) return {};
+
+    // connections closing a cycle (found by a depth-first search started
+    // from the nodes without inputs) are reversed:
+    QVector<QVector<int>> succ(n);
+    {
+        QVector<int> roots;
+        for(int v = 0; v < n; v++)
+            if(graph.in[v].isEmpty())
+                roots.push_back(v);
+        for(int v = 0; v < n; v++)
+            if(!graph.in[v].isEmpty())
+                roots.push_back(v);
+
+        QVector<char> state(n, 0); // 0: new, 1: on the stack, 2: done
+        QVector<QPair<int, int>> stack; // node, next connection
+        for(int root : as_const(roots))
+        {
+            if(state[root]) continue;
+            state[root] = 1;
+            stack.push_back(qMakePair(root, 0));
+            while(!stack.isEmpty())
+            {
+                int v = stack.last().first;
+                int e = stack.last().second++;
+                if(e >= graph.out[v].size())
+                {
+                    state[v] = 2;
+                    stack.removeLast();
+                    continue;
+                }
+                int w = graph.out[v][e];
+                if(state[w] == 1)
+                {
+                    succ[w].push_back(v);
+                    continue;
+                }
+                succ[v].push_back(w);
+                if(state[w] == 0)
+                {
+                    state[w] = 1;
+                    stack.push_back(qMakePair(w, 0));
+                }
+            }
+        }
+    }
+
+    // each node goes one layer below its lowest predecessor:
+    QVector<int> layer(n, 0), indegree(n, 0);
+    for(int v = 0; v < n; v++)
+        for(int w : as_const(succ[v]))
+            indegree[w]++;
+    QVector<int> queue;
+    for(int v = 0; v < n; v++)
+        if(indegree[v] == 0)
+            queue.push_back(v);
+    for(int i = 0; i < queue.size(); i++)
+    {
+        int v = queue[i];
+        for(int w : as_const(succ[v]))
+        {
+            layer[w] = std::max(layer[w], layer[v] + 1);
+            if(--indegree[w] == 0)
+                queue.push_back(w);
+        }
+    }
+    if(canceled.load()) return {};
+
+    // connections spanning several layers get a dummy vertex on each layer
+    // they cross, so that only adjacent layers are connected:
+    QVector<int> vertexLayer = layer;
+    QVector<qreal> initialX(n);
+    for(int v = 0; v < n; v++)
+        initialX[v] = graph.pos[v].x();
+    QVector<QVector<int>> up(n), down(n);
+    for(int v = 0; v < n; v++)
+    {
+        for(int w : as_const(succ[v]))
+        {
+            int prev = v;
+            for(int l = layer[v] + 1; l < layer[w]; l++)
+            {
+                int d = vertexLayer.size();
+                vertexLayer.push_back(l);
+                initialX.push_back(graph.pos[v].x());
+                up.push_back(QVector<int>{prev});
+                down.push_back(QVector<int>());
+                down[prev].push_back(d);
+                prev = d;
+            }
+            down[prev].push_back(w);
+            up[w].push_back(prev);
+        }
+    }
+
+    const int count = vertexLayer.size();
+    const int layerCount = *std::max_element(vertexLayer.constBegin(), vertexLayer.constEnd()) + 1;
+    QVector<QVector<int>> layers(layerCount);
+    for(int v = 0; v < count; v++)
+        layers[vertexLayer[v]].push_back(v);
+
+    // start from the current left to right order:
+    QVector<int> order(count);
+    for(auto &vs : layers)
+    {
+        std::stable_sort(vs.begin(), vs.end(), [&initialX](int a, int b) {return initialX[a] < initialX[b];});
+        for(int i = 0; i < vs.size(); i++)
+            order[vs[i]] = i;
+    }
+
+    // crossing reduction: sort each layer by the barycenter of its
+    // neighbours in the adjacent layer, sweeping down and up; a sweep
+    // handles the odd layers, then the even ones, so that the layers of a
+    // half sweep only read fixed neighbours and are sorted in parallel
+    QVector<qreal> keys(count);
+    qreal *key = keys.data();
+    int *pos = order.data();
+    QVector<int> *layerData = layers.data();
+    auto sortLayer = [&](int l, const QVector<QVector<int>> &adj) {
+        QVector<int> &vs = layerData[l];
+        for(int i = 0; i < vs.size(); i++)
+        {
+            const QVector<int> &a = adj.at(vs[i]);
+            if(a.isEmpty())
+            {
+                key[vs[i]] = i;
+                continue;
+            }
+            qreal sum = 0;
+            for(int u : a)
+                sum += pos[u];
+            key[vs[i]] = sum / a.size();
+        }
+        std::stable_sort(vs.begin(), vs.end(), [key](int a, int b) {return key[a] < key[b];});
+        for(int i = 0; i < vs.size(); i++)
+            pos[vs[i]] = i;
+    };
+    auto sweep = [&](int first, const QVector<QVector<int>> &adj) {
+        parallelFor((layerCount - first + 1) / 2, [&](int i) {sortLayer(first + 2 * i, adj);}, 1);
+    };
+    for(int it = 0; it < settings.iterations; it++)
+    {
+        if(canceled.load()) return {};
+        sweep(1, up);
+        sweep(2, up);
+        sweep(0, down);
+        sweep(1, down);
+    }
+
+    // coordinates: each layer moves the centers of its nodes towards the
+    // mean x of their neighbours in the adjacent layer, keeping the order
+    // and nodeSpacing() between the nodes' sides; the left-aligned and
+    // right-aligned solutions are averaged
+    const qreal s = settings.nodeSpacing;
+    QVector<qreal> width(count, 0); // dummy vertices have none
+    std::copy(graph.width.constBegin(), graph.width.constEnd(), width.begin());
+    auto gap = [&width, s](int a, int b) {return (width[a] + width[b]) / 2 + s;};
+    QVector<qreal> x(count);
+    for(const auto &vs : as_const(layers))
+    {
+        qreal acc = 0;
+        for(int i = 0; i < vs.size(); i++)
+        {
+            if(i > 0) acc += gap(vs[i - 1], vs[i]);
+            x[vs[i]] = acc;
+        }
+        for(int v : vs)
+            x[v] -= acc / 2;
+    }
+    auto place = [&](int l, const QVector<QVector<int>> &adj) {
+        const QVector<int> &vs = layers[l];
+        const int m = vs.size();
+        if(m == 0) return;
+        QVector<qreal> want(m), a(m), b(m);
+        for(int i = 0; i < m; i++)
+        {
+            const QVector<int> &nb = adj[vs[i]];
+            if(nb.isEmpty())
+            {
+                want[i] = x[vs[i]];
+                continue;
+            }
+            qreal sum = 0;
+            for(int u : nb)
+                sum += x[u];
+            want[i] = sum / nb.size();
+        }
+        a[0] = want[0];
+        for(int i = 1; i < m; i++)
+            a[i] = std::max(want[i], a[i - 1] + gap(vs[i - 1], vs[i]));
+        b[m - 1] = want[m - 1];
+        for(int i = m - 2; i >= 0; i--)
+            b[i] = std::min(want[i], b[i + 1] - gap(vs[i], vs[i + 1]));
+        for(int i = 0; i < m; i++)
+            x[vs[i]] = (a[i] + b[i]) / 2;
+    };
+    for(int l = 1; l < layerCount; l++)
+        place(l, up);
+    for(int l = layerCount - 2; l >= 0; l--)
+        place(l, down);
+    for(int l = 1; l < layerCount; l++)
+        place(l, up);
+    if(canceled.load()) return {};
+
+    // keep the top-left corner where the graph was:
+    qreal originX = graph.pos[0].x(), originY = graph.pos[0].y(), minX = x[0] - width[0] / 2;
+    for(int v = 0; v < n; v++)
+    {
+        originX = std::min(originX, graph.pos[v].x());
+        originY = std::min(originY, graph.pos[v].y());
+        minX = std::min(minX, x[v] - width[v] / 2);
+    }
+    QVector<QPointF> ret(n);
+    for(int v = 0; v < n; v++)
+        ret[v] = QPointF(originX + x[v] - width[v] / 2 - minX, originY + layer[v] * settings.layerSpacing);
+    return ret;
+}
+
+QVector<QPointF> QDataflowLayout::forceDirected(const Graph &graph, const Settings &settings, const QAtomicInt &canceled)
+{
+    const int n = graph.pos.size();
+    if(n == 0) return {};
+
+    // Fruchterman-Reingold, starting from the current positions; nodes only
+    // repel the nodes within two spacings, found with a grid, so that a
+    // step costs O(n), and the forces on each node are summed in parallel
+    const qreal k = settings.nodeSpacing;
+    const qreal cellSize = 2 * k;
+    const qreal t0 = k * std::max(qreal(1), std::sqrt(qreal(n)) / 8);
+    auto cellKey = [cellSize](const QPointF &p) {
+        qint32 cx = qint32(std::floor(p.x() / cellSize)), cy = qint32(std::floor(p.y() / cellSize));
+        return qMakePair(cx, cy);
+    };
+    auto key = [](qint32 cx, qint32 cy) {
+        return (quint64(quint32(cx)) << 32) | quint64(quint32(cy));
+    };
+
+    QVector<QPointF> ret = graph.pos;
+    QPointF *pos = ret.data();
+    QVector<QPointF> disp(n);
+    QPointF *d = disp.data();
+    for(int it = 0; it < settings.iterations; it++)
+    {
+        if(canceled.load()) return {};
+
+        QHash<quint64, QVector<int>> grid;
+        grid.reserve(n);
+        for(int v = 0; v < n; v++)
+        {
+            QPair<qint32, qint32> c = cellKey(pos[v]);
+            grid[key(c.first, c.second)].push_back(v);
+        }
+        const QHash<quint64, QVector<int>> &cgrid = grid;
+
+        parallelFor(n, [&](int v) {
+            QPointF f;
+            QPair<qint32, qint32> c = cellKey(pos[v]);
+            for(int dy = -1; dy <= 1; dy++)
+            {
+                for(int dx = -1; dx <= 1; dx++)
+                {
+                    auto cell = cgrid.constFind(key(c.first + dx, c.second + dy));
+                    if(cell == cgrid.constEnd()) continue;
+                    for(int u : *cell)
+                    {
+                        if(u == v) continue;
+                        QPointF delta = pos[v] - pos[u];
+                        qreal dist2 = QPointF::dotProduct(delta, delta);
+                        if(dist2 >= cellSize * cellSize) continue;
+                        if(dist2 < 1e-6)
+                        {
+                            // nodes on the same spot: pick a direction
+                            qreal angle = v * 2.39996;
+                            delta = QPointF(std::cos(angle), std::sin(angle));
+                            dist2 = 1;
+                        }
+                        f += delta * (k * k / dist2);
+                    }
+                }
+            }
+            auto attract = [&](int u) {
+                QPointF delta = pos[u] - pos[v];
+                f += delta * (std::sqrt(QPointF::dotProduct(delta, delta)) / k);
+            };
+            for(int u : graph.out.at(v))
+                attract(u);
+            for(int u : graph.in.at(v))
+                attract(u);
+            d[v] = f;
+        });
+
+        // the temperature limits the displacement, and cools down linearly
+        const qreal t = t0 * (1 - qreal(it) / settings.iterations);
+        parallelFor(n, [&](int v) {
+            qreal len = std::sqrt(QPointF::dotProduct(d[v], d[v]));
+            if(len > t)
+                pos[v] += d[v] * (t / len);
+            else
+                pos[v] += d[v];
+        });
+    }
+    return ret;
+}
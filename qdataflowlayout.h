@@ -0,0 +1,108 @@
+/* QDataflowCanvas - a dataflow widget for Qt
+ * Copyright (C) 2017-2018 Federico Ferri
+ * Copyright (C) 2018 Kuba Ober
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QDATAFLOWLAYOUT_H
+#define QDATAFLOWLAYOUT_H
+
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QObject>
+#include <QPointer>
+#include <QPointF>
+#include <QVector>
+#include <functional>
+
+class QDataflowModel;
+class QDataflowModelNode;
+
+// Computes the positions of all the nodes of a model. start() takes a copy
+// of the graph, the layout runs in a worker thread, and the result is
+// applied with a single QDataflowModel::setNodesPos() call.
+class QDataflowLayout : public QObject
+{
+    Q_OBJECT
+public:
+    enum Algorithm {
+        Layered,      // layers follow the connections, top to bottom
+        ForceDirected // connected nodes attract, nearby nodes repel
+    };
+
+    explicit QDataflowLayout(QDataflowModel *model, QObject *parent = {});
+    ~QDataflowLayout() override;
+
+    QDataflowModel * model();
+
+    Algorithm algorithm();
+    void setAlgorithm(Algorithm algorithm);
+    // the gap between the nodes of a layer (layered), or the ideal length
+    // of a connection (force-directed)
+    qreal nodeSpacing();
+    void setNodeSpacing(qreal spacing);
+    // the width of each node, which the layered layout keeps apart; by
+    // default it is estimated from the text and iolet counts
+    void setNodeWidth(const std::function<qreal(QDataflowModelNode*)> &nodeWidth);
+    qreal layerSpacing();
+    void setLayerSpacing(qreal spacing);
+    // crossing reduction sweeps (layered) or simulation steps (force-directed)
+    int iterations();
+    void setIterations(int count);
+
+    bool isRunning() const;
+
+public Q_SLOTS:
+    void start();
+    void cancel();
+
+Q_SIGNALS:
+    void finished();
+
+protected:
+    struct Settings
+    {
+        Algorithm algorithm;
+        qreal nodeSpacing;
+        qreal layerSpacing;
+        int iterations;
+    };
+
+    // nodes are numbered; out[i] and in[i] list the other end of each
+    // connection leaving and entering node i
+    struct Graph
+    {
+        QVector<QPointF> pos;
+        QVector<qreal> width;
+        QVector<QVector<int>> out;
+        QVector<QVector<int>> in;
+    };
+
+    static qreal estimateNodeWidth(QDataflowModelNode *node);
+    static QVector<QPointF> layered(const Graph &graph, const Settings &settings, const QAtomicInt &canceled);
+    static QVector<QPointF> forceDirected(const Graph &graph, const Settings &settings, const QAtomicInt &canceled);
+
+protected Q_SLOTS:
+    void onFinished();
+
+private:
+    QPointer<QDataflowModel> model_;
+    Settings settings_;
+    std::function<qreal(QDataflowModelNode*)> nodeWidth_;
+    QVector<QDataflowModelNode*> nodes_;
+    QFutureWatcher<QVector<QPointF>> watcher_;
+    QAtomicInt canceled_;
+};
+
+#endif // QDATAFLOWLAYOUT_H
@@ -0,0 +1,398 @@
+/* QDataflowCanvas - a dataflow widget for Qt
+ * Copyright (C) 2017-2018 Federico Ferri
+ * Copyright (C) 2018 Kuba Ober
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qdataflowminimap.h"
+#include "qdataflowcanvas.h"
+#include "qdataflowmodel.h"
+#include "utility.h"
+
+#include <cmath>
+
+#include <QGraphicsScene>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QResizeEvent>
+
+// tile coordinates are kept in 29 bits each, the level in the top bits
+static quint64 tileKey(int level, int tx, int ty)
+{
+    return (quint64(level) << 58) | (quint64(quint32(tx) & 0x1fffffff) << 29) | quint64(quint32(ty) & 0x1fffffff);
+}
+
+static void tileFromKey(quint64 key, int *level, int *tx, int *ty)
+{
+    // sign-extend the 29 bit coordinates
+    *level = int(key >> 58);
+    *tx = int(qint32(quint32((key >> 29) & 0x1fffffff) << 3) >> 3);
+    *ty = int(qint32(quint32(key & 0x1fffffff) << 3) >> 3);
+}
+
+QDataflowMinimap::QDataflowMinimap(QWidget *parent)
+    : QWidget(parent)
+{
+    tiles_.setMaxCost(tileCacheSize());
+    setMinimumSize(80, 60);
+    setCursor(Qt::PointingHandCursor);
+}
+
+QDataflowCanvas * QDataflowMinimap::canvas()
+{
+    return canvas_;
+}
+
+void QDataflowMinimap::setCanvas(QDataflowCanvas *canvas)
+{
+    if(canvas_)
+    {
+        QObject::disconnect(canvas_, &QDataflowCanvas::modelChanged, this, &QDataflowMinimap::setModel);
+        QObject::disconnect(canvas_, &QDataflowCanvas::visibleRectChanged, this, &QDataflowMinimap::onVisibleRectChanged);
+        QObject::disconnect(canvas_->scene(), &QGraphicsScene::sceneRectChanged, this, static_cast<void (QWidget::*)()>(&QWidget::update));
+    }
+
+    canvas_ = canvas;
+    if(!canvas_)
+    {
+        setModel(nullptr);
+        return;
+    }
+
+    QObject::connect(canvas_, &QDataflowCanvas::modelChanged, this, &QDataflowMinimap::setModel);
+    QObject::connect(canvas_, &QDataflowCanvas::visibleRectChanged, this, &QDataflowMinimap::onVisibleRectChanged);
+    QObject::connect(canvas_->scene(), &QGraphicsScene::sceneRectChanged, this, static_cast<void (QWidget::*)()>(&QWidget::update));
+    visibleRect_ = canvas_->visibleRect();
+    setModel(canvas_->model());
+}
+
+void QDataflowMinimap::setModel(QDataflowModel *model)
+{
+    if(model_)
+        QObject::disconnect(model_, nullptr, this, nullptr);
+
+    model_ = model;
+    nodeIndex_.clear();
+    connectionIndex_.clear();
+    tiles_.clear();
+    dirty_.clear();
+    update();
+    if(!model_) return;
+
+    QObject::connect(model_, &QDataflowModel::nodeAdded, this, &QDataflowMinimap::onNodeAdded);
+    QObject::connect(model_, &QDataflowModel::nodeRemoved, this, &QDataflowMinimap::onNodeRemoved);
+    QObject::connect(model_, &QDataflowModel::nodeValidChanged, this, &QDataflowMinimap::onNodeValidChanged);
+    QObject::connect(model_, &QDataflowModel::nodePosChanged, this, &QDataflowMinimap::onNodePosChanged);
+    QObject::connect(model_, &QDataflowModel::nodesPosChanged, this, &QDataflowMinimap::onNodesPosChanged);
+    QObject::connect(model_, &QDataflowModel::connectionAdded, this, &QDataflowMinimap::onConnectionAdded);
+    QObject::connect(model_, &QDataflowModel::connectionRemoved, this, &QDataflowMinimap::onConnectionRemoved);
+
+    for(auto *node : as_const(model_->nodes()))
+        nodeIndex_.update(node, nodeRect(node));
+    for(auto *conn : as_const(model_->connections()))
+    {
+        QLineF line = connectionLine(conn);
+        connectionIndex_.update(conn, QRectF(line.p1(), line.p2()).normalized());
+    }
+}
+
+QRectF QDataflowMinimap::worldRect() const
+{
+    QRectF world = visibleRect_;
+    if(canvas_)
+        world = world.united(canvas_->scene()->sceneRect());
+    return world;
+}
+
+QTransform QDataflowMinimap::sceneToWidget() const
+{
+    // the whole world fits in the widget, centered
+    QRectF world = worldRect();
+    QTransform t;
+    if(world.isEmpty()) return t;
+    qreal scale = std::min(width() / world.width(), height() / world.height());
+    t.translate((width() - world.width() * scale) / 2, (height() - world.height() * scale) / 2);
+    t.scale(scale, scale);
+    t.translate(-world.left(), -world.top());
+    return t;
+}
+
+int QDataflowMinimap::level() const
+{
+    // the coarsest level whose pixels are not larger than the widget's
+    qreal scenePerPixel = 1 / sceneToWidget().m11();
+    if(scenePerPixel <= 1) return 0;
+    return std::min(int(std::floor(std::log2(scenePerPixel))), maxLevel());
+}
+
+QRectF QDataflowMinimap::tileRect(int level, int tx, int ty) const
+{
+    const qreal span = tileSize() * std::ldexp(qreal(1), level);
+    return QRectF(tx * span, ty * span, span, span);
+}
+
+QImage QDataflowMinimap::renderTile(int level, int tx, int ty) const
+{
+    QImage image(tileSize(), tileSize(), QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    const QRectF rect = tileRect(level, tx, ty);
+    const qreal pixel = std::ldexp(qreal(1), level);
+    const QRectF query = rect.adjusted(-pixel, -pixel, pixel, pixel);
+
+    QVector<QLineF> lines;
+    connectionIndex_.visit(query, [&](QDataflowModelConnection *conn, const QRectF &) {
+        lines.push_back(connectionLine(conn));
+    });
+    QVector<QRectF> rects[2]; // [valid]
+    nodeIndex_.visit(query, [&](QDataflowModelNode *node, const QRectF &r) {
+        rects[node->isValid() ? 1 : 0].push_back(r);
+    });
+
+    QPainter painter(&image);
+    painter.scale(1 / pixel, 1 / pixel);
+    painter.translate(-rect.topLeft());
+    painter.setPen(QPen(Qt::darkGray, 0));
+    painter.drawLines(lines);
+
+    // nodes smaller than a few pixels are just filled
+    const bool tiny = nodeSize().height() / pixel < 3;
+    for(int valid = 0; valid < 2; valid++)
+    {
+        QColor color = valid ? Qt::black : Qt::red;
+        if(tiny)
+        {
+            painter.setPen(Qt::NoPen);
+            painter.setBrush(color);
+        }
+        else
+        {
+            painter.setPen(QPen(color, 0));
+            painter.setBrush(Qt::white);
+        }
+        painter.drawRects(rects[valid]);
+    }
+    return image;
+}
+
+QRectF QDataflowMinimap::nodeRect(QDataflowModelNode *node) const
+{
+    return QRectF(node->pos(), nodeSize());
+}
+
+QLineF QDataflowMinimap::connectionLine(QDataflowModelConnection *conn) const
+{
+    // from the bottom of the source node to the top of the destination
+    QPointF p1 = conn->source()->node()->pos() + QPointF(0, nodeSize().height());
+    QPointF p2 = conn->dest()->node()->pos();
+    return QLineF(p1, p2);
+}
+
+void QDataflowMinimap::updateNode(QDataflowModelNode *node)
+{
+    if(nodeIndex_.contains(node))
+        invalidate(nodeIndex_.rect(node));
+    QRectF r = nodeRect(node);
+    nodeIndex_.update(node, r);
+    invalidate(r);
+
+    for(auto *inlet : as_const(node->inlets()))
+        for(auto *conn : as_const(inlet->connections()))
+            updateConnection(conn);
+    for(auto *outlet : as_const(node->outlets()))
+        for(auto *conn : as_const(outlet->connections()))
+            updateConnection(conn);
+}
+
+void QDataflowMinimap::updateConnection(QDataflowModelConnection *conn)
+{
+    if(connectionIndex_.contains(conn))
+        invalidate(connectionIndex_.rect(conn));
+    QLineF line = connectionLine(conn);
+    QRectF r = QRectF(line.p1(), line.p2()).normalized();
+    connectionIndex_.update(conn, r);
+    invalidate(r);
+}
+
+void QDataflowMinimap::invalidate(const QRectF &rect)
+{
+    // tiles are dropped at the next paint, so that many changes in a row
+    // are handled at once
+    dirty_.push_back(rect);
+    update();
+}
+
+void QDataflowMinimap::dropDirtyTiles()
+{
+    if(dirty_.isEmpty()) return;
+
+    // past some point, re-rendering everything is cheaper than checking
+    if(dirty_.size() > 256)
+    {
+        tiles_.clear();
+        dirty_.clear();
+        return;
+    }
+
+    for(quint64 key : as_const(tiles_.keys()))
+    {
+        int level, tx, ty;
+        tileFromKey(key, &level, &tx, &ty);
+        // drawn shapes may extend by a pixel out of their rectangle
+        const qreal pixel = std::ldexp(qreal(1), level);
+        QRectF r = tileRect(level, tx, ty).adjusted(-pixel, -pixel, pixel, pixel);
+        for(const QRectF &d : as_const(dirty_))
+        {
+            if(r.intersects(d.adjusted(-1, -1, 1, 1)))
+            {
+                tiles_.remove(key);
+                break;
+            }
+        }
+    }
+    dirty_.clear();
+}
+
+void QDataflowMinimap::centerCanvasOn(const QPoint &pos)
+{
+    if(!canvas_) return;
+    QPointF scenePos = sceneToWidget().inverted().map(QPointF(pos));
+    canvas_->centerOn(scenePos - dragOffset_);
+}
+
+int QDataflowMinimap::tileCacheSize() const
+{
+    // a tile is drawn between tileSize() / 2 and tileSize() pixels wide,
+    // and the view can straddle one more tile per axis
+    const int half = tileSize() / 2;
+    return qMax(64, 2 * (width() / half + 2) * (height() / half + 2));
+}
+
+void QDataflowMinimap::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().window());
+    if(!canvas_ || !model_) return;
+
+    dropDirtyTiles();
+
+    const QTransform t = sceneToWidget();
+    const QRectF world = worldRect();
+    painter.fillRect(t.mapRect(world), palette().base());
+
+    const int l = level();
+    const qreal span = tileSize() * std::ldexp(qreal(1), l);
+    const int tx0 = int(std::floor(world.left() / span)), tx1 = int(std::floor(world.right() / span));
+    const int ty0 = int(std::floor(world.top() / span)), ty1 = int(std::floor(world.bottom() / span));
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    for(int ty = ty0; ty <= ty1; ty++)
+    {
+        for(int tx = tx0; tx <= tx1; tx++)
+        {
+            quint64 key = tileKey(l, tx, ty);
+            QImage tile;
+            if(QImage *cached = tiles_.object(key))
+            {
+                tile = *cached;
+            }
+            else
+            {
+                tile = renderTile(l, tx, ty);
+                tiles_.insert(key, new QImage(tile));
+            }
+            painter.drawImage(t.mapRect(tileRect(l, tx, ty)), tile);
+        }
+    }
+
+    painter.setPen(QPen(palette().highlight().color(), 1));
+    painter.setBrush(QColor(0, 0, 255, 32));
+    painter.drawRect(t.mapRect(visibleRect_));
+}
+
+void QDataflowMinimap::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    tiles_.setMaxCost(tileCacheSize());
+}
+
+void QDataflowMinimap::mousePressEvent(QMouseEvent *event)
+{
+    if(event->button() != Qt::LeftButton) return;
+
+    // grabbing the visible rect keeps it under the mouse; clicking
+    // elsewhere centers the canvas there
+    QPointF scenePos = sceneToWidget().inverted().map(QPointF(event->pos()));
+    dragOffset_ = visibleRect_.contains(scenePos) ? scenePos - visibleRect_.center() : QPointF();
+    centerCanvasOn(event->pos());
+}
+
+void QDataflowMinimap::mouseMoveEvent(QMouseEvent *event)
+{
+    if(event->buttons() & Qt::LeftButton)
+        centerCanvasOn(event->pos());
+}
+
+void QDataflowMinimap::onVisibleRectChanged(const QRectF &rect)
+{
+    visibleRect_ = rect;
+    update();
+}
+
+void QDataflowMinimap::onNodeAdded(QDataflowModelNode *node)
+{
+    updateNode(node);
+}
+
+void QDataflowMinimap::onNodeRemoved(QDataflowModelNode *node)
+{
+    // its connections have already been removed
+    if(!nodeIndex_.contains(node)) return;
+    invalidate(nodeIndex_.rect(node));
+    nodeIndex_.remove(node);
+}
+
+void QDataflowMinimap::onNodeValidChanged(QDataflowModelNode *node, bool valid)
+{
+    Q_UNUSED(valid);
+
+    if(nodeIndex_.contains(node))
+        invalidate(nodeIndex_.rect(node));
+}
+
+void QDataflowMinimap::onNodePosChanged(QDataflowModelNode *node, const QPoint &pos)
+{
+    Q_UNUSED(pos);
+
+    updateNode(node);
+}
+
+void QDataflowMinimap::onNodesPosChanged(const QList<QDataflowModelNode*> &nodes)
+{
+    for(auto *node : nodes)
+        updateNode(node);
+}
+
+void QDataflowMinimap::onConnectionAdded(QDataflowModelConnection *conn)
+{
+    updateConnection(conn);
+}
+
+void QDataflowMinimap::onConnectionRemoved(QDataflowModelConnection *conn)
+{
+    if(!connectionIndex_.contains(conn)) return;
+    invalidate(connectionIndex_.rect(conn));
+    connectionIndex_.remove(conn);
+}
@@ -0,0 +1,99 @@
+/* QDataflowCanvas - a dataflow widget for Qt
+ * Copyright (C) 2017-2018 Federico Ferri
+ * Copyright (C) 2018 Kuba Ober
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QDATAFLOWMINIMAP_H
+#define QDATAFLOWMINIMAP_H
+
+#include <QCache>
+#include <QImage>
+#include <QPointer>
+#include <QTransform>
+#include <QWidget>
+
+#include "qdataflowspatialindex.h"
+
+class QDataflowCanvas;
+class QDataflowModel;
+class QDataflowModelNode;
+class QDataflowModelConnection;
+
+// An overview of the whole patch of a canvas, with the canvas' visible
+// area drawn as a rectangle which can be dragged around.
+//
+// The patch is drawn from the model, into square tiles of tileSize()
+// pixels; at level l one tile pixel covers 2^l scene units. Tiles are
+// cached, and only those overlapping a changed node or connection are
+// rendered again.
+class QDataflowMinimap : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit QDataflowMinimap(QWidget *parent = {});
+
+    QDataflowCanvas * canvas();
+    void setCanvas(QDataflowCanvas *canvas);
+
+    int tileSize() const {return 256;}
+    int maxLevel() const {return 20;}
+    // twice the tiles that can be in view
+    int tileCacheSize() const;
+    QSizeF nodeSize() const {return QSizeF(60, 20);}
+
+    QSize sizeHint() const override {return QSize(240, 180);}
+
+protected:
+    QRectF worldRect() const;
+    QTransform sceneToWidget() const;
+    int level() const;
+    QRectF tileRect(int level, int tx, int ty) const;
+    QImage renderTile(int level, int tx, int ty) const;
+    QRectF nodeRect(QDataflowModelNode *node) const;
+    QLineF connectionLine(QDataflowModelConnection *conn) const;
+    void updateNode(QDataflowModelNode *node);
+    void updateConnection(QDataflowModelConnection *conn);
+    void invalidate(const QRectF &rect);
+    void dropDirtyTiles();
+    void centerCanvasOn(const QPoint &pos);
+
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+
+protected Q_SLOTS:
+    void setModel(QDataflowModel *model);
+    void onVisibleRectChanged(const QRectF &rect);
+    void onNodeAdded(QDataflowModelNode *node);
+    void onNodeRemoved(QDataflowModelNode *node);
+    void onNodeValidChanged(QDataflowModelNode *node, bool valid);
+    void onNodePosChanged(QDataflowModelNode *node, const QPoint &pos);
+    void onNodesPosChanged(const QList<QDataflowModelNode*> &nodes);
+    void onConnectionAdded(QDataflowModelConnection *conn);
+    void onConnectionRemoved(QDataflowModelConnection *conn);
+
+private:
+    QPointer<QDataflowCanvas> canvas_;
+    QPointer<QDataflowModel> model_;
+    QDataflowGridIndex<QDataflowModelNode*> nodeIndex_;
+    QDataflowGridIndex<QDataflowModelConnection*> connectionIndex_;
+    QCache<quint64, QImage> tiles_;
+    QVector<QRectF> dirty_;
+    QRectF visibleRect_;
+    QPointF dragOffset_;
+};
+
+#endif // QDATAFLOWMINIMAP_H
@@ -16,13 +16,50 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "qdataflowmodel.h"
-#include "qdataflowcanvas.h"
 #include "utility.h"
 
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QThread>
+#include <QTimer>
+
+// objects created by a thread other than their parent's get their parent
+// later, with QDataflowModel::adopt()
+static QObject * parentInThread(QObject *parent)
+{
+    return parent && parent->thread() == QThread::currentThread() ? parent : nullptr;
+}
+
 QDataflowModel::QDataflowModel(QObject *parent)
-    : QObject(parent)
+    : QObject(parent), flushPending_(false), flushing_(false)
+{
+    flushTimer_ = new QTimer(this);
+    flushTimer_->setSingleShot(true);
+    flushTimer_->setInterval(40);
+    QObject::connect(flushTimer_, &QTimer::timeout, this, &QDataflowModel::flushChanges);
+}
+
+QDataflowModel::~QDataflowModel()
 {
+    // the objects whose change was never signaled are owned too
+    for(const auto &adopted : as_const(pending_.adopted))
+        adopted.first->setParent(adopted.second);
+}
+
+QMutex * QDataflowModel::mutex() const
+{
+    return &mutex_;
+}
 
+int QDataflowModel::flushInterval() const
+{
+    return flushTimer_->interval();
+}
+
+void QDataflowModel::setFlushInterval(int msec)
+{
+    flushTimer_->setInterval(qMax(0, msec));
 }
 
 QDataflowModelNode * QDataflowModel::newNode(const QPoint &pos, const QString &text, int inletCount, int outletCount)
@@ -40,94 +77,488 @@ QDataflowModelConnection * QDataflowModel::newConnection(QDataflowModelNode *sou
 QDataflowModelNode * QDataflowModel::create(const QPoint &pos, const QString &text, int inletCount, int outletCount)
 {
     QDataflowModelNode *node = newNode(pos, text, inletCount, outletCount);
-    nodes_.insert(node);
-    QObject::connect(node, &QDataflowModelNode::validChanged, this, &QDataflowModel::onValidChanged);
-    QObject::connect(node, &QDataflowModelNode::posChanged, this, &QDataflowModel::onPosChanged);
-    QObject::connect(node, &QDataflowModelNode::textChanged, this, &QDataflowModel::onTextChanged);
-    QObject::connect(node, &QDataflowModelNode::inletCountChanged, this, &QDataflowModel::onInletCountChanged);
-    QObject::connect(node, &QDataflowModelNode::outletCountChanged, this, &QDataflowModel::onOutletCountChanged);
-    Q_EMIT nodeAdded(node);
+    {
+        QMutexLocker locker(&mutex_);
+        adopt(node, this);
+        nodes_.insert(node);
+        nodeIndex_.update(node, QRectF(node->pos_, node->pos_));
+        record().addNode(node);
+    }
+    notify();
     return node;
 }
 
 void QDataflowModel::remove(QDataflowModelNode *node)
 {
     if(!node) return;
-    if(!nodes_.contains(node)) return;
-    for(auto *inlet : as_const(node->inlets()))
-        for(auto *conn : as_const(inlet->connections()))
-            removeConnection(conn);
-    for(auto *outlet : as_const(node->outlets()))
-        for(auto *conn : as_const(outlet->connections()))
-            removeConnection(conn);
-    QObject::disconnect(node, &QDataflowModelNode::validChanged, this, &QDataflowModel::onValidChanged);
-    QObject::disconnect(node, &QDataflowModelNode::posChanged, this, &QDataflowModel::onPosChanged);
-    QObject::disconnect(node, &QDataflowModelNode::textChanged, this, &QDataflowModel::onTextChanged);
-    QObject::disconnect(node, &QDataflowModelNode::inletCountChanged, this, &QDataflowModel::onInletCountChanged);
-    QObject::disconnect(node, &QDataflowModelNode::outletCountChanged, this, &QDataflowModel::onOutletCountChanged);
-    nodes_.remove(node);
-    Q_EMIT nodeRemoved(node);
+    {
+        QMutexLocker locker(&mutex_);
+        if(!nodes_.contains(node)) return;
+        for(auto *inlet : as_const(node->inlets_))
+        {
+            const auto conns = inlet->connections_;
+            for(auto *conn : conns)
+                removeConnection(conn);
+        }
+        for(auto *outlet : as_const(node->outlets_))
+        {
+            const auto conns = outlet->connections_;
+            for(auto *conn : conns)
+                removeConnection(conn);
+        }
+        nodes_.remove(node);
+        nodeIndex_.remove(node);
+        record().removeNode(node);
+    }
+    notify();
 }
 
 QDataflowModelConnection * QDataflowModel::connect(QDataflowModelConnection *conn)
 {
     if(!conn) return {};
-    if(!findConnections(conn).isEmpty()) return {};
-    addConnection(conn);
+    {
+        QMutexLocker locker(&mutex_);
+        if(!findConnections(conn).isEmpty()) return {};
+        addConnection(conn);
+    }
+    notify();
     return conn;
 }
 
 QDataflowModelConnection * QDataflowModel::connect(QDataflowModelNode *sourceNode, int sourceOutlet, QDataflowModelNode *destNode, int destInlet)
 {
     if(!sourceNode || !destNode) return {};
-    if(!findConnections(sourceNode, sourceOutlet, destNode, destInlet).isEmpty()) return {};
+    {
+        QMutexLocker locker(&mutex_);
+        if(!findConnections(sourceNode, sourceOutlet, destNode, destInlet).isEmpty()) return {};
+    }
+    // newConnection() reads the nodes, so it runs unlocked
     QDataflowModelConnection *conn = newConnection(sourceNode, sourceOutlet, destNode, destInlet);
-    addConnection(conn);
+    bool added;
+    {
+        QMutexLocker locker(&mutex_);
+        addConnection(conn);
+        added = connections_.contains(conn);
+    }
+    if(!added)
+    {
+        // refused, made meanwhile by another thread, or its iolets are gone
+        delete conn;
+        return {};
+    }
+    notify();
     return conn;
 }
 
 void QDataflowModel::disconnect(QDataflowModelConnection *conn)
 {
     if(!conn) return;
-    for(auto *conn : as_const(findConnections(conn)))
     {
-        removeConnection(conn);
+        QMutexLocker locker(&mutex_);
+        for(auto *conn : as_const(findConnections(conn)))
+        {
+            removeConnection(conn);
+        }
     }
+    notify();
 }
 
 void QDataflowModel::disconnect(QDataflowModelNode *sourceNode, int sourceOutlet, QDataflowModelNode *destNode, int destInlet)
 {
     if(!sourceNode || !destNode) return;
-    for(auto *conn : as_const(findConnections(sourceNode, sourceOutlet, destNode, destInlet)))
     {
-        removeConnection(conn);
+        QMutexLocker locker(&mutex_);
+        for(auto *conn : as_const(findConnections(sourceNode, sourceOutlet, destNode, destInlet)))
+        {
+            removeConnection(conn);
+        }
     }
+    notify();
 }
 
 QSet<QDataflowModelNode*> QDataflowModel::nodes()
 {
-    return nodes_;
+    QMutexLocker locker(&mutex_);
+    QSet<QDataflowModelNode*> ret = nodes_;
+    if(hidesPending())
+        ret.subtract(pending_.addedNodes);
+    return ret;
 }
 
 QSet<QDataflowModelConnection*> QDataflowModel::connections()
 {
-    return connections_;
+    QMutexLocker locker(&mutex_);
+    QSet<QDataflowModelConnection*> ret = connections_;
+    if(hidesPending())
+        ret.subtract(pending_.addedConnections);
+    return ret;
+}
+
+QJsonObject QDataflowModel::toJson()
+{
+    QMutexLocker locker(&mutex_);
+    QHash<QDataflowModelNode*, int> index;
+    QJsonArray nodes;
+    for(auto *node : as_const(nodes_))
+    {
+        index.insert(node, nodes.size());
+        QJsonObject obj;
+        obj.insert(QStringLiteral("text"), node->text_);
+        obj.insert(QStringLiteral("pos"), QJsonArray{node->pos_.x(), node->pos_.y()});
+        obj.insert(QStringLiteral("inlets"), node->inlets_.length());
+        obj.insert(QStringLiteral("outlets"), node->outlets_.length());
+        nodes.append(obj);
+    }
+
+    QJsonArray connections;
+    for(auto *conn : as_const(connections_))
+    {
+        connections.append(QJsonArray{
+            index.value(conn->source()->node()), conn->source()->index(),
+            index.value(conn->dest()->node()), conn->dest()->index()
+        });
+    }
+
+    QJsonObject patch;
+    patch.insert(QStringLiteral("nodes"), nodes);
+    patch.insert(QStringLiteral("connections"), connections);
+    return patch;
+}
+
+bool QDataflowModel::fromJson(const QJsonObject &patch)
+{
+    bool ok = true;
+
+    QList<QDataflowModelNode*> nodes;
+    const QJsonArray nodesArray = patch.value(QStringLiteral("nodes")).toArray();
+    for(const QJsonValue &value : nodesArray)
+    {
+        QJsonObject obj = value.toObject();
+        QJsonArray pos = obj.value(QStringLiteral("pos")).toArray();
+        if(pos.size() != 2) ok = false;
+        nodes << create(QPoint(pos.at(0).toInt(), pos.at(1).toInt()),
+                        obj.value(QStringLiteral("text")).toString(),
+                        obj.value(QStringLiteral("inlets")).toInt(),
+                        obj.value(QStringLiteral("outlets")).toInt());
+    }
+
+    const QJsonArray connectionsArray = patch.value(QStringLiteral("connections")).toArray();
+    for(const QJsonValue &value : connectionsArray)
+    {
+        QJsonArray c = value.toArray();
+        int src = c.at(0).toInt(-1), outlet = c.at(1).toInt(-1);
+        int dst = c.at(2).toInt(-1), inlet = c.at(3).toInt(-1);
+        if(c.size() != 4 || src < 0 || src >= nodes.size() || dst < 0 || dst >= nodes.size() ||
+                outlet < 0 || outlet >= nodes[src]->outletCount() ||
+                inlet < 0 || inlet >= nodes[dst]->inletCount())
+        {
+            ok = false;
+            continue;
+        }
+        connect(nodes[src], outlet, nodes[dst], inlet);
+    }
+
+    return ok;
+}
+
+bool QDataflowModel::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "cannot open" << fileName << ":" << file.errorString();
+        return false;
+    }
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if(!doc.isObject())
+    {
+        qWarning() << "cannot parse" << fileName << ":" << error.errorString();
+        return false;
+    }
+    return fromJson(doc.object());
+}
+
+bool QDataflowModel::save(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "cannot write" << fileName << ":" << file.errorString();
+        return false;
+    }
+    return file.write(QJsonDocument(toJson()).toJson()) >= 0;
+}
+
+QList<QDataflowModelNode*> QDataflowModel::nodesIn(const QRectF &rect) const
+{
+    QMutexLocker locker(&mutex_);
+    const QSet<QDataflowModelNode*> *hidden = hidesPending() ? &pending_.addedNodes : nullptr;
+    QList<QDataflowModelNode*> ret;
+    nodeIndex_.visit(rect, [&ret, hidden](QDataflowModelNode *node, const QRectF &) {
+        if(!hidden || !hidden->contains(node))
+            ret.push_back(node);
+    });
+    return ret;
+}
+
+QList<QDataflowModelNode*> QDataflowModel::nearestNodes(const QPointF &pos, int k) const
+{
+    QMutexLocker locker(&mutex_);
+    const bool hide = hidesPending();
+    QList<QDataflowModelNode*> ret;
+    for(auto *node : as_const(nodeIndex_.nearest(pos, k + (hide ? pending_.addedNodes.size() : 0))))
+    {
+        if(ret.size() == k) break;
+        if(!hide || !pending_.addedNodes.contains(node))
+            ret.push_back(node);
+    }
+    return ret;
+}
+
+QDataflowModelNode * QDataflowModel::nearestNode(const QPointF &pos) const
+{
+    QList<QDataflowModelNode*> nodes = nearestNodes(pos, 1);
+    return nodes.isEmpty() ? nullptr : nodes.first();
+}
+
+QRectF QDataflowModel::nodesBounds() const
+{
+    QMutexLocker locker(&mutex_);
+    return nodeIndex_.bounds();
+}
+
+void QDataflowModel::setNodesPos(const QHash<QDataflowModelNode*, QPoint> &positions)
+{
+    {
+        QMutexLocker locker(&mutex_);
+        for(auto it = positions.constBegin(); it != positions.constEnd(); ++it)
+        {
+            QDataflowModelNode *node = it.key();
+            if(!nodes_.contains(node) || node->pos_ == it.value()) continue;
+            node->pos_ = it.value();
+            nodeMoved(node);
+        }
+    }
+    notify();
+}
+
+void QDataflowModel::flushChanges()
+{
+    // changes made by the slots are emitted after the current ones
+    if(QThread::currentThread() != thread() || flushing_) return;
+
+    flushing_ = true;
+    ChangeSet changes;
+    while(takeChanges(changes))
+        emitChanges(changes);
+    flushing_ = false;
+}
+
+QDataflowModel::ChangeSet & QDataflowModel::record()
+{
+    if(QThread::currentThread() != thread())
+        pending_.queued = true;
+    return pending_;
+}
+
+void QDataflowModel::adopt(QObject *obj, QObject *parent)
+{
+    if(obj->parent() == parent) return;
+    // only the object's thread can move it, and only the model's thread
+    // can give it a parent living there
+    if(obj->thread() != thread())
+        obj->moveToThread(thread());
+    if(QThread::currentThread() == thread())
+        obj->setParent(parent);
+    else
+        record().adopted.push_back(qMakePair(obj, parent));
+}
+
+void QDataflowModel::nodeChanged(QDataflowModelNode *node, int change)
+{
+    if(nodes_.contains(node))
+        record().changeNode(node, change);
+}
+
+void QDataflowModel::nodeMoved(QDataflowModelNode *node)
+{
+    if(!nodes_.contains(node)) return;
+    nodeIndex_.update(node, QRectF(node->pos_, node->pos_));
+    record().moveNode(node);
+}
+
+bool QDataflowModel::hidesPending() const
+{
+    return QThread::currentThread() == thread();
+}
+
+void QDataflowModel::notify()
+{
+    if(QThread::currentThread() == thread())
+    {
+        flushChanges();
+        return;
+    }
+    QMutexLocker locker(&mutex_);
+    if(flushPending_ || pending_.isEmpty()) return;
+    // the timer can only be started in the model's thread
+    flushPending_ = true;
+    QMetaObject::invokeMethod(flushTimer_, "start", Qt::QueuedConnection);
+}
+
+bool QDataflowModel::takeChanges(ChangeSet &changes)
+{
+    QMutexLocker locker(&mutex_);
+    flushPending_ = false;
+    changes = ChangeSet();
+    if(pending_.isEmpty()) return false;
+    std::swap(changes, pending_);
+    return true;
+}
+
+void QDataflowModel::emitChanges(const ChangeSet &changes)
+{
+    for(const auto &adopted : as_const(changes.adopted))
+        adopted.first->setParent(adopted.second);
+
+    // removals first, additions last, so that connections are always
+    // signaled when both of their nodes exist
+    if(changes.queued)
+        Q_EMIT changesAboutToBeApplied(changes.size());
+    for(auto *conn : as_const(changes.connectionsRemoved))
+        Q_EMIT connectionRemoved(conn);
+    for(auto *node : as_const(changes.nodesRemoved))
+        Q_EMIT nodeRemoved(node);
+    for(auto *node : as_const(changes.nodesAdded))
+        if(changes.addedNodes.contains(node))
+            Q_EMIT nodeAdded(node);
+    for(auto it = changes.changedNodes.constBegin(); it != changes.changedNodes.constEnd(); ++it)
+    {
+        QDataflowModelNode *node = it.key();
+        if(it.value() & ChangeSet::Valid)
+        {
+            const bool valid = node->isValid();
+            Q_EMIT node->validChanged(valid);
+            Q_EMIT nodeValidChanged(node, valid);
+        }
+        if(it.value() & ChangeSet::Text)
+        {
+            const QString text = node->text();
+            Q_EMIT node->textChanged(text);
+            Q_EMIT nodeTextChanged(node, text);
+        }
+        if(it.value() & ChangeSet::Inlets)
+        {
+            const int count = node->inletCount();
+            Q_EMIT node->inletCountChanged(count);
+            Q_EMIT nodeInletCountChanged(node, count);
+        }
+        if(it.value() & ChangeSet::Outlets)
+        {
+            const int count = node->outletCount();
+            Q_EMIT node->outletCountChanged(count);
+            Q_EMIT nodeOutletCountChanged(node, count);
+        }
+    }
+    if(changes.movedNodes.size() == 1)
+    {
+        QDataflowModelNode *node = *changes.movedNodes.constBegin();
+        const QPoint pos = node->pos();
+        Q_EMIT node->posChanged(pos);
+        Q_EMIT nodePosChanged(node, pos);
+    }
+    else if(!changes.movedNodes.isEmpty())
+    {
+        QList<QDataflowModelNode*> moved;
+        moved.reserve(changes.movedNodes.size());
+        for(auto *node : as_const(changes.movedNodes))
+        {
+            Q_EMIT node->posChanged(node->pos());
+            moved.push_back(node);
+        }
+        Q_EMIT nodesPosChanged(moved);
+    }
+    for(auto *conn : as_const(changes.connectionsAdded))
+        if(changes.addedConnections.contains(conn))
+            Q_EMIT connectionAdded(conn);
+    if(changes.queued)
+        Q_EMIT changesApplied();
+}
+
+bool QDataflowModel::ChangeSet::isEmpty() const
+{
+    return nodesAdded.isEmpty() && nodesRemoved.isEmpty() && movedNodes.isEmpty() &&
+            changedNodes.isEmpty() && connectionsAdded.isEmpty() && connectionsRemoved.isEmpty() &&
+            adopted.isEmpty();
+}
+
+int QDataflowModel::ChangeSet::size() const
+{
+    return addedNodes.size() + nodesRemoved.size() + movedNodes.size() + changedNodes.size() +
+            addedConnections.size() + connectionsRemoved.size();
+}
+
+void QDataflowModel::ChangeSet::addNode(QDataflowModelNode *node)
+{
+    nodesAdded.push_back(node);
+    addedNodes.insert(node);
+}
+
+void QDataflowModel::ChangeSet::removeNode(QDataflowModelNode *node)
+{
+    movedNodes.remove(node);
+    changedNodes.remove(node);
+    // a node added in the same change set is never signaled:
+    if(!addedNodes.remove(node))
+        nodesRemoved.push_back(node);
+}
+
+void QDataflowModel::ChangeSet::moveNode(QDataflowModelNode *node)
+{
+    if(!addedNodes.contains(node))
+        movedNodes.insert(node);
+}
+
+void QDataflowModel::ChangeSet::changeNode(QDataflowModelNode *node, int change)
+{
+    if(!addedNodes.contains(node))
+        changedNodes[node] |= change;
+}
+
+void QDataflowModel::ChangeSet::addConnection(QDataflowModelConnection *conn)
+{
+    connectionsAdded.push_back(conn);
+    addedConnections.insert(conn);
+}
+
+void QDataflowModel::ChangeSet::removeConnection(QDataflowModelConnection *conn)
+{
+    if(!addedConnections.remove(conn))
+        connectionsRemoved.push_back(conn);
 }
 
 void QDataflowModel::addConnection(QDataflowModelConnection *conn)
 {
-    if(!conn) return;
+    if(!conn || !conn->source() || !conn->dest()) return;
     if(!findConnections(conn).isEmpty()) return;
-    if(!conn->source()->canMakeConnectionTo(conn->dest()) || !conn->dest()->canAcceptConnectionFrom(conn->source()))
+    // the connection is made unlocked: its nodes or iolets may be gone meanwhile
+    const QDataflowModelOutlet *source = conn->source();
+    const QDataflowModelInlet *dest = conn->dest();
+    if(!nodes_.contains(source->node()) || source->node()->outlets_.value(source->index()) != source) return;
+    if(!nodes_.contains(dest->node()) || dest->node()->inlets_.value(dest->index()) != dest) return;
+    if(!QDataflowModelIOlet::typesMatch(conn->source(), conn->dest()))
     {
-        qDebug() << "cannoct connect outlet" << conn->source() << "to inlet" << conn->dest();
+        // the nodes' text cannot be printed here, it takes the mutex
+        qDebug() << "cannot connect outlet" << conn->source()->index() << "of type" << conn->source()->type_
+                 << "to inlet" << conn->dest()->index() << "of type" << conn->dest()->type_;
         return;
     }
-    conn->setParent(this);
+    adopt(conn, this);
     connections_.insert(conn);
     conn->source()->addConnection(conn);
     conn->dest()->addConnection(conn);
-    Q_EMIT connectionAdded(conn);
+    record().addConnection(conn);
 }
 
 void QDataflowModel::removeConnection(QDataflowModelConnection *conn)
@@ -137,7 +568,7 @@ void QDataflowModel::removeConnection(QDataflowModelConnection *conn)
     conn->source()->removeConnection(conn);
     conn->dest()->removeConnection(conn);
     connections_.remove(conn);
-    Q_EMIT connectionRemoved(conn);
+    record().removeConnection(conn);
 }
 
 QList<QDataflowModelConnection*> QDataflowModel::findConnections(QDataflowModelConnection *conn) const
@@ -156,63 +587,40 @@ QList<QDataflowModelConnection*> QDataflowModel::findConnections(QDataflowModelN
 {
     if(!sourceNode || !destNode) return QList<QDataflowModelConnection*>();
     QList<QDataflowModelConnection*> ret;
-    for(auto *conn : as_const(connections_))
+    // only the connections of the source outlet can match:
+    if(sourceOutlet < 0 || sourceOutlet >= sourceNode->outlets_.length()) return ret;
+    for(auto *conn : as_const(sourceNode->outlets_[sourceOutlet]->connections_))
     {
-        QDataflowModelOutlet *src = conn->source();
         QDataflowModelInlet *dst = conn->dest();
-        if(src->node() == sourceNode && src->index() == sourceOutlet && dst->node() == destNode && dst->index() == destInlet)
+        if(dst->node() == destNode && dst->index() == destInlet)
             ret.push_back(conn);
     }
     return ret;
 }
 
-void QDataflowModel::onValidChanged(bool valid)
-{
-    if(QDataflowModelNode *node = dynamic_cast<QDataflowModelNode*>(sender()))
-        Q_EMIT nodeValidChanged(node, valid);
-}
-
-void QDataflowModel::onPosChanged(const QPoint &pos)
-{
-    if(QDataflowModelNode *node = dynamic_cast<QDataflowModelNode*>(sender()))
-        Q_EMIT nodePosChanged(node, pos);
-}
-
-void QDataflowModel::onTextChanged(const QString &text)
-{
-    if(QDataflowModelNode *node = dynamic_cast<QDataflowModelNode*>(sender()))
-        Q_EMIT nodeTextChanged(node, text);
-}
-
-void QDataflowModel::onInletCountChanged(int count)
-{
-    if(QDataflowModelNode *node = dynamic_cast<QDataflowModelNode*>(sender()))
-        Q_EMIT nodeInletCountChanged(node, count);
-}
-
-void QDataflowModel::onOutletCountChanged(int count)
-{
-    if(QDataflowModelNode *node = dynamic_cast<QDataflowModelNode*>(sender()))
-        Q_EMIT nodeOutletCountChanged(node, count);
-}
-
 QDataflowModelNode::QDataflowModelNode(QDataflowModel *parent, const QPoint &pos, const QString &text, int inletCount, int outletCount)
-    : QObject(parent), valid_(false), pos_(pos), text_(text), dataflowMetaObject_()
+    : QObject(parentInThread(parent)), model_(parent), valid_(false), pos_(pos), text_(text), dataflowMetaObject_()
 {
-    for(int i = 0; i < inletCount; i++) addInlet();
-    for(int i = 0; i < outletCount; i++) addOutlet();
+    // not in the model yet, so nothing to lock or signal
+    for(int i = 0; i < inletCount; i++) appendInlet(new QDataflowModelInlet(this, i));
+    for(int i = 0; i < outletCount; i++) appendOutlet(new QDataflowModelOutlet(this, i));
 }
 
 QDataflowModelNode::QDataflowModelNode(QDataflowModel *parent, const QPoint &pos, const QString &text, const QStringList &inletTypes, const QStringList &outletTypes)
-    : QObject(parent), valid_(false), pos_(pos), text_(text), dataflowMetaObject_()
+    : QObject(parentInThread(parent)), model_(parent), valid_(false), pos_(pos), text_(text), dataflowMetaObject_()
 {
-    for(auto &inletType : inletTypes) addInlet(inletType);
-    for(auto &outletType : outletTypes) addOutlet(outletType);
+    for(auto &inletType : inletTypes) appendInlet(new QDataflowModelInlet(this, inlets_.length(), {}, inletType));
+    for(auto &outletType : outletTypes) appendOutlet(new QDataflowModelOutlet(this, outlets_.length(), {}, outletType));
 }
 
 QDataflowModel * QDataflowModelNode::model()
 {
-    return static_cast<QDataflowModel*>(parent());
+    return model_;
+}
+
+QMutex * QDataflowModelNode::mutex() const
+{
+    return model_ ? model_->mutex() : nullptr;
 }
 
 QDataflowMetaObject * QDataflowModelNode::dataflowMetaObject() const
@@ -233,26 +641,31 @@ void QDataflowModelNode::setDataflowMetaObject(QDataflowMetaObject *dataflowMeta
 
 bool QDataflowModelNode::isValid() const
 {
+    QMutexLocker locker(mutex());
     return valid_;
 }
 
 QPoint QDataflowModelNode::pos() const
 {
+    QMutexLocker locker(mutex());
     return pos_;
 }
 
 QString QDataflowModelNode::text() const
 {
+    QMutexLocker locker(mutex());
     return text_;
 }
 
 QList<QDataflowModelInlet*> QDataflowModelNode::inlets() const
 {
+    QMutexLocker locker(mutex());
     return inlets_;
 }
 
 QDataflowModelInlet * QDataflowModelNode::inlet(int index) const
 {
+    QMutexLocker locker(mutex());
     if(index >= 0 && index < inlets_.length())
         return inlets_[index];
     else
@@ -261,16 +674,19 @@ QDataflowModelInlet * QDataflowModelNode::inlet(int index) const
 
 int QDataflowModelNode::inletCount() const
 {
+    QMutexLocker locker(mutex());
     return inlets_.length();
 }
 
 QList<QDataflowModelOutlet*> QDataflowModelNode::outlets() const
 {
+    QMutexLocker locker(mutex());
     return outlets_;
 }
 
 QDataflowModelOutlet * QDataflowModelNode::outlet(int index) const
 {
+    QMutexLocker locker(mutex());
     if(index >= 0 && index < outlets_.length())
         return outlets_[index];
     else
@@ -279,79 +695,101 @@ QDataflowModelOutlet * QDataflowModelNode::outlet(int index) const
 
 int QDataflowModelNode::outletCount() const
 {
+    QMutexLocker locker(mutex());
     return outlets_.length();
 }
 
 void QDataflowModelNode::setValid(bool valid)
 {
-    if(valid_ == valid) return;
-    valid_ = valid;
-    Q_EMIT validChanged(valid);
+    {
+        QMutexLocker locker(mutex());
+        if(valid_ == valid) return;
+        valid_ = valid;
+        changed(QDataflowModel::ChangeSet::Valid);
+    }
+    notify();
 }
 
 void QDataflowModelNode::setPos(const QPoint &pos)
 {
-    if(pos_ == pos) return;
-    pos_ = pos;
-    Q_EMIT posChanged(pos);
+    {
+        QMutexLocker locker(mutex());
+        if(pos_ == pos) return;
+        pos_ = pos;
+        if(model_) model_->nodeMoved(this);
+    }
+    notify();
 }
 
 void QDataflowModelNode::setText(const QString &text)
 {
-    if(text_ == text) return;
-    text_ = text;
-    Q_EMIT textChanged(text);
+    {
+        QMutexLocker locker(mutex());
+        if(text_ == text) return;
+        text_ = text;
+        changed(QDataflowModel::ChangeSet::Text);
+    }
+    notify();
 }
 
 void QDataflowModelNode::addInlet(const QString &name, const QString &type)
 {
-    addInlet(new QDataflowModelInlet(this, inletCount(), name, type));
+    {
+        QMutexLocker locker(mutex());
+        appendInlet(new QDataflowModelInlet(this, inlets_.length(), name, type));
+        changed(QDataflowModel::ChangeSet::Inlets);
+    }
+    notify();
 }
 
 void QDataflowModelNode::removeLastInlet()
 {
-    if(inlets_.isEmpty()) return;
-    QDataflowModelInlet *inlet = inlets_.back();
-    for(auto *conn : as_const(inlet->connections()))
-        model()->disconnect(conn);
-    inlets_.pop_back();
-    Q_EMIT inletCountChanged(inletCount());
+    {
+        QMutexLocker locker(mutex());
+        if(inlets_.isEmpty()) return;
+        dropLastInlet();
+        changed(QDataflowModel::ChangeSet::Inlets);
+    }
+    notify();
 }
 
 void QDataflowModelNode::setInletCount(int count)
 {
-    if(inletCount() == count) return;
-
-    bool shouldBlockSignals = blockSignals(true);
-
-    while(inletCount() < count)
-        addInlet();
+    {
+        QMutexLocker locker(mutex());
+        if(inlets_.length() == count) return;
 
-    while(inletCount() > count)
-        removeLastInlet();
+        while(inlets_.length() < count)
+            appendInlet(new QDataflowModelInlet(this, inlets_.length()));
 
-    blockSignals(shouldBlockSignals);
+        while(inlets_.length() > count)
+            dropLastInlet();
 
-    Q_EMIT inletCountChanged(count);
+        changed(QDataflowModel::ChangeSet::Inlets);
+    }
+    notify();
 }
 
 void QDataflowModelNode::setInletTypes(const QStringList &types)
 {
-    int oldCount = inletCount();
-
-    bool shouldBlockSignals = blockSignals(true);
+    {
+        QMutexLocker locker(mutex());
+        int oldCount = inlets_.length();
 
-    while(inletCount() > 0)
-        removeLastInlet();
+        // the inlets which are kept are retyped in place, with their connections
+        while(inlets_.length() > types.length())
+            dropLastInlet();
 
-    for(auto &type : types)
-        addInlet({}, type);
+        for(int i = 0; i < inlets_.length(); i++)
+            retypeInlet(inlets_[i], types[i]);
 
-    blockSignals(shouldBlockSignals);
+        for(int i = inlets_.length(); i < types.length(); i++)
+            appendInlet(new QDataflowModelInlet(this, i, {}, types[i]));
 
-    int newCount = inletCount();
-    if(oldCount != newCount)
-        Q_EMIT inletCountChanged(newCount);
+        if(oldCount != inlets_.length())
+            changed(QDataflowModel::ChangeSet::Inlets);
+    }
+    notify();
 }
 
 void QDataflowModelNode::setInletTypes(std::initializer_list<const char*> types_)
@@ -369,53 +807,62 @@ void QDataflowModelNode::setInletTypes(std::initializer_list<const char*> types_
 
 void QDataflowModelNode::addOutlet(QString name, QString type)
 {
-    addOutlet(new QDataflowModelOutlet(this, outletCount(), name, type));
+    {
+        QMutexLocker locker(mutex());
+        appendOutlet(new QDataflowModelOutlet(this, outlets_.length(), name, type));
+        changed(QDataflowModel::ChangeSet::Outlets);
+    }
+    notify();
 }
 
 void QDataflowModelNode::removeLastOutlet()
 {
-    if(outlets_.isEmpty()) return;
-    QDataflowModelOutlet *outlet = outlets_.back();
-    for(auto *conn : as_const(outlet->connections()))
-        model()->disconnect(conn);
-    outlets_.pop_back();
-    Q_EMIT outletCountChanged(outletCount());
+    {
+        QMutexLocker locker(mutex());
+        if(outlets_.isEmpty()) return;
+        dropLastOutlet();
+        changed(QDataflowModel::ChangeSet::Outlets);
+    }
+    notify();
 }
 
 void QDataflowModelNode::setOutletCount(int count)
 {
-    if(outletCount() == count) return;
-
-    bool shouldBlockSignals = blockSignals(true);
-
-    while(outletCount() < count)
-        addOutlet();
+    {
+        QMutexLocker locker(mutex());
+        if(outlets_.length() == count) return;
 
-    while(outletCount() > count)
-        removeLastOutlet();
+        while(outlets_.length() < count)
+            appendOutlet(new QDataflowModelOutlet(this, outlets_.length()));
 
-    blockSignals(shouldBlockSignals);
+        while(outlets_.length() > count)
+            dropLastOutlet();
 
-    Q_EMIT outletCountChanged(count);
+        changed(QDataflowModel::ChangeSet::Outlets);
+    }
+    notify();
 }
 
 void QDataflowModelNode::setOutletTypes(const QStringList &types)
 {
-    int oldCount = outletCount();
-
-    bool shouldBlockSignals = blockSignals(true);
+    {
+        QMutexLocker locker(mutex());
+        int oldCount = outlets_.length();
 
-    while(outletCount() > 0)
-        removeLastOutlet();
+        // the outlets which are kept are retyped in place, with their connections
+        while(outlets_.length() > types.length())
+            dropLastOutlet();
 
-    for(auto &type : types)
-        addOutlet({}, type);
+        for(int i = 0; i < outlets_.length(); i++)
+            retypeOutlet(outlets_[i], types[i]);
 
-    blockSignals(shouldBlockSignals);
+        for(int i = outlets_.length(); i < types.length(); i++)
+            appendOutlet(new QDataflowModelOutlet(this, i, {}, types[i]));
 
-    int newCount = outletCount();
-    if(oldCount != newCount)
-        Q_EMIT outletCountChanged(newCount);
+        if(oldCount != outlets_.length())
+            changed(QDataflowModel::ChangeSet::Outlets);
+    }
+    notify();
 }
 
 void QDataflowModelNode::setOutletTypes(std::initializer_list<const char *> types_)
@@ -434,17 +881,91 @@ void QDataflowModelNode::setOutletTypes(std::initializer_list<const char *> type
 void QDataflowModelNode::addInlet(QDataflowModelInlet *inlet)
 {
     if(!inlet) return;
-    inlet->setParent(this);
-    inlets_.append(inlet);
-    Q_EMIT inletCountChanged(inletCount());
+    {
+        QMutexLocker locker(mutex());
+        appendInlet(inlet);
+        changed(QDataflowModel::ChangeSet::Inlets);
+    }
+    notify();
 }
 
 void QDataflowModelNode::addOutlet(QDataflowModelOutlet *outlet)
 {
     if(!outlet) return;
-    outlet->setParent(this);
+    {
+        QMutexLocker locker(mutex());
+        appendOutlet(outlet);
+        changed(QDataflowModel::ChangeSet::Outlets);
+    }
+    notify();
+}
+
+void QDataflowModelNode::appendInlet(QDataflowModelInlet *inlet)
+{
+    if(model_)
+        model_->adopt(inlet, this);
+    else
+        inlet->setParent(this);
+    inlets_.append(inlet);
+}
+
+void QDataflowModelNode::appendOutlet(QDataflowModelOutlet *outlet)
+{
+    if(model_)
+        model_->adopt(outlet, this);
+    else
+        outlet->setParent(this);
     outlets_.append(outlet);
-    Q_EMIT outletCountChanged(outletCount());
+}
+
+void QDataflowModelNode::dropLastInlet()
+{
+    const QDataflowModelInlet *inlet = inlets_.takeLast();
+    if(!model_) return;
+    const auto conns = inlet->connections_;
+    for(auto *conn : conns)
+        model_->removeConnection(conn);
+}
+
+void QDataflowModelNode::dropLastOutlet()
+{
+    const QDataflowModelOutlet *outlet = outlets_.takeLast();
+    if(!model_) return;
+    const auto conns = outlet->connections_;
+    for(auto *conn : conns)
+        model_->removeConnection(conn);
+}
+
+void QDataflowModelNode::retypeInlet(QDataflowModelInlet *inlet, const QString &type)
+{
+    if(inlet->type_ == type) return;
+    inlet->type_ = type;
+    if(!model_) return;
+    const auto conns = inlet->connections_;
+    for(auto *conn : conns)
+        if(!QDataflowModelIOlet::typesMayMatch(conn->source(), inlet))
+            model_->removeConnection(conn);
+}
+
+void QDataflowModelNode::retypeOutlet(QDataflowModelOutlet *outlet, const QString &type)
+{
+    if(outlet->type_ == type) return;
+    outlet->type_ = type;
+    if(!model_) return;
+    const auto conns = outlet->connections_;
+    for(auto *conn : conns)
+        if(!QDataflowModelIOlet::typesMayMatch(outlet, conn->dest()))
+            model_->removeConnection(conn);
+}
+
+void QDataflowModelNode::changed(int change)
+{
+    if(model_) model_->nodeChanged(this, change);
+}
+
+void QDataflowModelNode::notify()
+{
+    if(model_) model_->notify();
 }
 
 QDebug operator<<(QDebug debug, const QDataflowModelNode &node)
@@ -462,7 +983,7 @@ QDebug operator<<(QDebug debug, const QDataflowModelNode *node)
 }
 
 QDataflowModelIOlet::QDataflowModelIOlet(QDataflowModelNode *parent, int index, const QString &name, const QString &type)
-    : QObject(parent), node_(parent), index_(index), name_(name), type_(type)
+    : QObject(parentInThread(parent)), node_(parent), index_(index), name_(name), type_(type)
 {
 
 }
@@ -484,9 +1005,28 @@ int QDataflowModelIOlet::index() const
 
 QString QDataflowModelIOlet::type() const
 {
+    QMutexLocker locker(node_->mutex());
     return type_;
 }
 
+QMutex * QDataflowModelIOlet::mutex() const
+{
+    return node_->mutex();
+}
+
+bool QDataflowModelIOlet::typesMatch(const QDataflowModelIOlet *outlet, const QDataflowModelIOlet *inlet)
+{
+    if(inlet->type_ == "*") return true;
+    return outlet->type_ == inlet->type_;
+}
+
+bool QDataflowModelIOlet::typesMayMatch(const QDataflowModelIOlet *outlet, const QDataflowModelIOlet *inlet)
+{
+    // an untyped end may still be given a matching type
+    if(outlet->type_ == "*" || inlet->type_ == "*") return true;
+    return outlet->type_ == inlet->type_;
+}
+
 void QDataflowModelIOlet::addConnection(QDataflowModelConnection *conn)
 {
     connections_.push_back(conn);
@@ -499,7 +1039,15 @@ void QDataflowModelIOlet::removeConnection(QDataflowModelConnection *conn)
 
 QList<QDataflowModelConnection*> QDataflowModelIOlet::connections() const
 {
-    return connections_;
+    QMutexLocker locker(node_->mutex());
+    QDataflowModel *model = node_->model_;
+    if(!model || !model->hidesPending() || model->pending_.addedConnections.isEmpty())
+        return connections_;
+    QList<QDataflowModelConnection*> ret;
+    for(auto *conn : as_const(connections_))
+        if(!model->pending_.addedConnections.contains(conn))
+            ret.push_back(conn);
+    return ret;
 }
 
 QDataflowModelInlet::QDataflowModelInlet(QDataflowModelNode *parent, int index, const QString &name, const QString &type)
@@ -510,8 +1058,8 @@ QDataflowModelInlet::QDataflowModelInlet(QDataflowModelNode *parent, int index,
 
 bool QDataflowModelInlet::canAcceptConnectionFrom(QDataflowModelOutlet *outlet)
 {
-    if(type() == "*") return true;
-    return type() == outlet->type();
+    QMutexLocker locker(mutex());
+    return typesMatch(outlet, this);
 }
 
 QDebug operator<<(QDebug debug, const QDataflowModelInlet &inlet)
@@ -536,8 +1084,8 @@ QDataflowModelOutlet::QDataflowModelOutlet(QDataflowModelNode *parent, int index
 
 bool QDataflowModelOutlet::canMakeConnectionTo(QDataflowModelInlet *inlet)
 {
-    if(inlet->type() == "*") return true;
-    return type() == inlet->type();
+    QMutexLocker locker(mutex());
+    return typesMatch(this, inlet);
 }
 
 QDebug operator<<(QDebug debug, const QDataflowModelOutlet &outlet)
@@ -555,13 +1103,13 @@ QDebug operator<<(QDebug debug, const QDataflowModelOutlet *outlet)
 }
 
 QDataflowModelConnection::QDataflowModelConnection(QDataflowModel *parent, QDataflowModelOutlet *source, QDataflowModelInlet *dest)
-    : QObject(parent), source_(source), dest_(dest)
+    : QObject(parentInThread(parent)), model_(parent), source_(source), dest_(dest)
 {
 }
 
 QDataflowModel * QDataflowModelConnection::model()
 {
-    return static_cast<QDataflowModel*>(parent());
+    return model_;
 }
 
 QDataflowModelOutlet * QDataflowModelConnection::source() const
@@ -615,6 +1163,7 @@ QDataflowModelDebugSignals::QDataflowModelDebugSignals(QDataflowModel *parent)
     QObject::connect(parent, &QDataflowModel::nodeAdded, this, &QDataflowModelDebugSignals::onNodeAdded);
     QObject::connect(parent, &QDataflowModel::nodeRemoved, this, &QDataflowModelDebugSignals::onNodeRemoved);
     QObject::connect(parent, &QDataflowModel::nodePosChanged, this, &QDataflowModelDebugSignals::onNodePosChanged);
+    QObject::connect(parent, &QDataflowModel::nodesPosChanged, this, &QDataflowModelDebugSignals::onNodesPosChanged);
     QObject::connect(parent, &QDataflowModel::nodeTextChanged, this, &QDataflowModelDebugSignals::onNodeTextChanged);
     QObject::connect(parent, &QDataflowModel::nodeInletCountChanged, this, &QDataflowModelDebugSignals::onNodeInletCountChanged);
     QObject::connect(parent, &QDataflowModel::nodeOutletCountChanged, this, &QDataflowModelDebugSignals::onNodeOutletCountChanged);
@@ -642,6 +1191,11 @@ void QDataflowModelDebugSignals::onNodePosChanged(QDataflowModelNode *node, cons
     debug() << "nodePosChanged" << node << pos;
 }
 
+void QDataflowModelDebugSignals::onNodesPosChanged(const QList<QDataflowModelNode*> &nodes)
+{
+    debug() << "nodesPosChanged" << nodes.size() << "nodes";
+}
+
 void QDataflowModelDebugSignals::onNodeTextChanged(QDataflowModelNode *node, const QString &text)
 {
     debug() << "nodeTextChanged" << node << text;
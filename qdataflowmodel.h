@@ -19,26 +19,55 @@
 #define QDATAFLOWMODEL_H
 
 #include <QObject>
+#include <QHash>
+#include <QJsonObject>
 #include <QSet>
 #include <QList>
+#include <QMutex>
+#include <QPair>
 #include <QPoint>
 #include <QString>
 #include <QStringList>
 #include <QDebug>
 #include <initializer_list>
 
+#include "qdataflowspatialindex.h"
+
 class QDataflowModelNode;
 class QDataflowModelIOlet;
 class QDataflowModelInlet;
 class QDataflowModelOutlet;
 class QDataflowModelConnection;
 class QDataflowMetaObject;
-
+class QTimer;
+
+// The model can be changed from any thread: every read and change takes
+// mutex(), which is not recursive and is never held while a signal is
+// emitted. The model, its nodes and connections live in the model's thread
+// (objects created by other threads are moved there, and get their parent
+// when their change is signaled), and all the signals, the nodes' included,
+// are only emitted in that thread: changes made in the model's thread are
+// signaled at once, while changes made by other threads are queued and
+// emitted together by flushChanges(), coalesced (e.g. a node added and
+// removed is not signaled at all, and the moved nodes are reported with a
+// single nodesPosChanged()), between changesAboutToBeApplied(), which
+// tells how many changes follow, and changesApplied(). Until then, the model's thread does not see the nodes
+// and connections they added. The dataflow meta objects are not covered by
+// this, and must be used in the model's thread only.
 class QDataflowModel : public QObject
 {
     Q_OBJECT
 public:
     explicit QDataflowModel(QObject *parent = {});
+    ~QDataflowModel() override;
+
+    // held by the protected methods' callers; calling the model while
+    // holding it deadlocks
+    QMutex * mutex() const;
+
+    // the changes made by other threads are signaled at most this often
+    int flushInterval() const;
+    void setFlushInterval(int msec);
 
 protected:
     virtual QDataflowModelNode * newNode(const QPoint &pos, const QString &text, int inletCount, int outletCount);
@@ -55,7 +84,34 @@ public:
     QSet<QDataflowModelNode*> nodes();
     QSet<QDataflowModelConnection*> connections();
 
+    // nodes whose position lies in rect
+    QList<QDataflowModelNode*> nodesIn(const QRectF &rect) const;
+    // the k nodes closest to pos, nearest first
+    QList<QDataflowModelNode*> nearestNodes(const QPointF &pos, int k = 1) const;
+    QDataflowModelNode * nearestNode(const QPointF &pos) const;
+    // the rectangle spanned by the node positions
+    QRectF nodesBounds() const;
+
+    // move several nodes as one change: emits a single nodesPosChanged()
+    // instead of nodePosChanged() for every node
+    virtual void setNodesPos(const QHash<QDataflowModelNode*, QPoint> &positions);
+
+    // patches are stored as JSON: a "nodes" array of {"text", "pos": [x, y],
+    // "inlets", "outlets"}, and a "connections" array of
+    // [sourceNode, outlet, destNode, inlet], nodes being array indices
+    QJsonObject toJson();
+    // adds the patch to the model; false if some of it was malformed
+    bool fromJson(const QJsonObject &patch);
+    bool load(const QString &fileName);
+    bool save(const QString &fileName);
+
+public Q_SLOTS:
+    // emits the changes queued by other threads; does nothing if called
+    // from a thread other than the model's
+    void flushChanges();
+
 protected:
+    // these are called with mutex() held
     virtual void addConnection(QDataflowModelConnection *conn);
     virtual void removeConnection(QDataflowModelConnection *conn);
     virtual QList<QDataflowModelConnection*> findConnections(QDataflowModelConnection *conn) const;
@@ -67,22 +123,63 @@ Q_SIGNALS:
     void nodeRemoved(QDataflowModelNode *node);
     void nodeValidChanged(QDataflowModelNode *node, bool valid);
     void nodePosChanged(QDataflowModelNode *node, const QPoint &pos);
+    void nodesPosChanged(const QList<QDataflowModelNode*> &nodes);
     void nodeTextChanged(QDataflowModelNode *node, const QString &text);
     void nodeInletCountChanged(QDataflowModelNode *node, int count);
     void nodeOutletCountChanged(QDataflowModelNode *node, int count);
     void connectionAdded(QDataflowModelConnection *conn);
     void connectionRemoved(QDataflowModelConnection *conn);
-
-private Q_SLOTS:
-    virtual void onValidChanged(bool valid);
-    virtual void onPosChanged(const QPoint &pos);
-    virtual void onTextChanged(const QString &text);
-    virtual void onInletCountChanged(int count);
-    virtual void onOutletCountChanged(int count);
+    void changesAboutToBeApplied(int count);
+    void changesApplied();
 
 private:
+    struct ChangeSet
+    {
+        enum NodeChange {Valid = 1, Text = 2, Inlets = 4, Outlets = 8};
+
+        QList<QDataflowModelNode*> nodesAdded, nodesRemoved;
+        QSet<QDataflowModelNode*> addedNodes, movedNodes;
+        QHash<QDataflowModelNode*, int> changedNodes;
+        QList<QDataflowModelConnection*> connectionsAdded, connectionsRemoved;
+        QSet<QDataflowModelConnection*> addedConnections;
+        QList<QPair<QObject*, QObject*>> adopted;
+        // made by a thread other than the model's
+        bool queued = false;
+
+        bool isEmpty() const;
+        int size() const;
+        void addNode(QDataflowModelNode *node);
+        void removeNode(QDataflowModelNode *node);
+        void moveNode(QDataflowModelNode *node);
+        void changeNode(QDataflowModelNode *node, int change);
+        void addConnection(QDataflowModelConnection *conn);
+        void removeConnection(QDataflowModelConnection *conn);
+    };
+
+    // with mutex_ held:
+    ChangeSet & record();
+    void adopt(QObject *obj, QObject *parent);
+    void nodeChanged(QDataflowModelNode *node, int change);
+    void nodeMoved(QDataflowModelNode *node);
+    bool hidesPending() const;
+
+    // with mutex_ released, after a change: signals it at once in the
+    // model's thread, or schedules flushChanges()
+    void notify();
+    bool takeChanges(ChangeSet &changes);
+    void emitChanges(const ChangeSet &changes);
+
+    mutable QMutex mutex_;
+    ChangeSet pending_;
+    bool flushPending_;
+    bool flushing_;
+    QTimer *flushTimer_;
     QSet<QDataflowModelNode*> nodes_;
     QSet<QDataflowModelConnection*> connections_;
+    QDataflowGridIndex<QDataflowModelNode*> nodeIndex_;
+
+    friend class QDataflowModelNode;
+    friend class QDataflowModelIOlet;
 };
 
 class QDataflowModelNode : public QObject
@@ -135,6 +232,21 @@ protected Q_SLOTS:
     void addOutlet(QDataflowModelOutlet *outlet);
 
 private:
+    QMutex * mutex() const;
+
+    // with the model's mutex held:
+    void appendInlet(QDataflowModelInlet *inlet);
+    void appendOutlet(QDataflowModelOutlet *outlet);
+    void dropLastInlet();
+    void dropLastOutlet();
+    void retypeInlet(QDataflowModelInlet *inlet, const QString &type);
+    void retypeOutlet(QDataflowModelOutlet *outlet, const QString &type);
+    void changed(int change);
+
+    // with the mutex released
+    void notify();
+
+    QDataflowModel *model_;
     bool valid_;
     QPoint pos_;
     QString text_;
@@ -143,6 +255,7 @@ private:
     QDataflowMetaObject *dataflowMetaObject_;
 
     friend class QDataflowModel;
+    friend class QDataflowModelIOlet;
 };
 
 QDebug operator<<(QDebug debug, const QDataflowModelNode &node);
@@ -162,16 +275,27 @@ public:
     QString name() const;
     QString type() const;
 
+    // called by the model, with its mutex held
     void addConnection(QDataflowModelConnection *conn);
     void removeConnection(QDataflowModelConnection *conn);
     QList<QDataflowModelConnection*> connections() const;
 
+protected:
+    QMutex * mutex() const;
+
+    // with the model's mutex held
+    static bool typesMatch(const QDataflowModelIOlet *outlet, const QDataflowModelIOlet *inlet);
+    static bool typesMayMatch(const QDataflowModelIOlet *outlet, const QDataflowModelIOlet *inlet);
+
 private:
     QList<QDataflowModelConnection*> connections_;
     QDataflowModelNode *node_;
     int index_;
     QString name_;
     QString type_;
+
+    friend class QDataflowModel;
+    friend class QDataflowModelNode;
 };
 
 class QDataflowModelInlet : public QDataflowModelIOlet
@@ -219,6 +343,7 @@ public:
     QDataflowModelInlet * dest() const;
 
 private:
+    QDataflowModel *model_;
     QDataflowModelOutlet *source_;
     QDataflowModelInlet *dest_;
 
@@ -266,6 +391,7 @@ private Q_SLOTS:
     void onNodeAdded(QDataflowModelNode *node);
     void onNodeRemoved(QDataflowModelNode *node);
     void onNodePosChanged(QDataflowModelNode *node, const QPoint &pos);
+    void onNodesPosChanged(const QList<QDataflowModelNode*> &nodes);
     void onNodeTextChanged(QDataflowModelNode *node, const QString &text);
     void onNodeInletCountChanged(QDataflowModelNode *node, int count);
     void onNodeOutletCountChanged(QDataflowModelNode *node, int count);
@@ -0,0 +1,12 @@
+# QDataflowCanvas - a dataflow widget for Qt
+# Copyright (C) 2017-2018 Federico Ferri
+# Copyright (C) 2018 Kuba Ober
+
+# links the static qdataflowmodel library
+
+QT += concurrent
+
+LIBS += -L$$OUT_PWD -lqdataflowmodel
+
+win32-msvc*: PRE_TARGETDEPS += $$OUT_PWD/qdataflowmodel.lib
+else: PRE_TARGETDEPS += $$OUT_PWD/libqdataflowmodel.a
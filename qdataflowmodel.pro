@@ -0,0 +1,25 @@
+# QDataflowCanvas - a dataflow widget for Qt
+# Copyright (C) 2017-2018 Federico Ferri
+# Copyright (C) 2018 Kuba Ober
+
+QT = core concurrent
+
+CONFIG += staticlib
+
+TARGET = qdataflowmodel
+TEMPLATE = lib
+DESTDIR = $$OUT_PWD
+
+include(common.pri)
+
+SOURCES += \
+    qdataflowlayout.cpp \
+    qdataflowmodel.cpp \
+    qdataflowruntime.cpp
+
+HEADERS += \
+    qdataflowlayout.h \
+    qdataflowmodel.h \
+    qdataflowruntime.h \
+    qdataflowspatialindex.h \
+    utility.h
@@ -0,0 +1,108 @@
+/* QDataflowCanvas - a dataflow widget for Qt
+ * Copyright (C) 2017-2018 Federico Ferri
+ * Copyright (C) 2018 Kuba Ober
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qdataflowmodel.h"
+#include "qdataflowruntime.h"
+#include "utility.h"
+
+#include <cstdio>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+
+// Runs a patch without a GUI: every input value is sent out of the source
+// nodes, and the text received by the sink nodes is written one per line.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("qdataflowrun"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Runs a dataflow patch, feeding the input values to its source nodes and writing what its sink nodes receive."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("patch"), QStringLiteral("The patch file (JSON)."));
+    parser.addPositionalArgument(QStringLiteral("values"), QStringLiteral("Input values; if none is given, they are read from the standard input, one per line."), QStringLiteral("[values...]"));
+    QCommandLineOption outputOption(QStringList() << QStringLiteral("o") << QStringLiteral("output"),
+                                    QStringLiteral("Write the output to <file> instead of the standard output."),
+                                    QStringLiteral("file"));
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    QStringList args = parser.positionalArguments();
+    if(args.isEmpty())
+        parser.showHelp(1);
+
+    QFile out;
+    if(parser.isSet(outputOption))
+    {
+        out.setFileName(parser.value(outputOption));
+        if(!out.open(QIODevice::WriteOnly | QIODevice::Text))
+        {
+            qCritical() << "cannot write" << out.fileName() << ":" << out.errorString();
+            return 1;
+        }
+    }
+    else
+    {
+        out.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    }
+    QTextStream outStream(&out);
+
+    QDataflowModel model;
+    QDataflowRuntime runtime;
+    runtime.setModel(&model);
+    QObject::connect(&runtime, &QDataflowRuntime::output, [&outStream](QDataflowModelNode *node, const QString &text) {
+        Q_UNUSED(node);
+        outStream << text << '\n';
+        outStream.flush();
+    });
+
+    if(!model.load(args.takeFirst()))
+    {
+        if(model.nodes().isEmpty()) return 1;
+        qWarning() << "some nodes or connections of the patch are invalid";
+    }
+    if(runtime.sources().isEmpty())
+        qWarning() << "the patch has no source node";
+
+    auto send = [&runtime](const QString &text) {
+        bool ok;
+        long value = text.trimmed().toLong(&ok);
+        if(ok)
+            runtime.send(value);
+        else if(!text.trimmed().isEmpty())
+            qWarning() << "not a number:" << text;
+    };
+
+    if(!args.isEmpty())
+    {
+        for(const QString &arg : as_const(args))
+            send(arg);
+    }
+    else
+    {
+        QTextStream in(stdin);
+        QString line;
+        while(in.readLineInto(&line))
+            send(line);
+    }
+
+    return 0;
+}
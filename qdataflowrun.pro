@@ -0,0 +1,17 @@
+# QDataflowCanvas - a dataflow widget for Qt
+# Copyright (C) 2017-2018 Federico Ferri
+# Copyright (C) 2018 Kuba Ober
+
+QT = core
+
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = qdataflowrun
+TEMPLATE = app
+
+include(common.pri)
+include(qdataflowmodel.pri)
+
+SOURCES += \
+    qdataflowrun.cpp
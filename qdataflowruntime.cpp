@@ -0,0 +1,219 @@
+/* QDataflowCanvas - a dataflow widget for Qt
+ * Copyright (C) 2017-2018 Federico Ferri
+ * Copyright (C) 2018 Kuba Ober
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qdataflowruntime.h"
+#include "utility.h"
+#define _USE_MATH_DEFINES
+#include <cmath>
+
+#include <QRegExp>
+
+class DFSource : public QDataflowMetaObject
+{
+public:
+    DFSource(QDataflowModelNode *node, const QStringList &args)
+        : QDataflowMetaObject(node)
+    {
+        Q_UNUSED(args);
+
+        //setInletCount(0);
+        setOutletTypes({"int"});
+    }
+};
+
+class DFMathBinOp : public QDataflowMetaObject
+{
+public:
+    DFMathBinOp(QDataflowModelNode *node, const QStringList &args)
+        : QDataflowMetaObject(node)
+    {
+        s = 0;
+
+        setInletTypes({"int", "int"});
+        setOutletTypes({"int"});
+
+        op = args[0];
+
+        if(args.length() > 1)
+            s = args[1].toLong();
+    }
+
+    void onDataReceved(int inlet, void *data)
+    {
+        if(inlet == 0)
+        {
+            int r = reinterpret_cast<long>(data);
+            if(op == "add") r = r + s;
+            if(op == "sub") r = r - s;
+            if(op == "mul") r = r * s;
+            if(op == "div") r = r / s;
+            if(op == "pow") r = pow(r, s);
+            sendData(0, reinterpret_cast<void*>(r));
+        }
+        else if(inlet == 1)
+        {
+            s = reinterpret_cast<long>(data);
+        }
+    }
+
+private:
+    QString op;
+    int s;
+};
+
+class DFNum2Str : public QDataflowMetaObject
+{
+public:
+    DFNum2Str(QDataflowModelNode *node, const QStringList &args)
+        : QDataflowMetaObject(node)
+    {
+        Q_UNUSED(args);
+
+        setInletTypes({"int"});
+        setOutletTypes({"string"});
+    }
+
+    void onDataReceved(int inlet, void *data)
+    {
+        Q_UNUSED(inlet);
+
+        QString s = QString::number(reinterpret_cast<long>(data));
+        sendData(0, reinterpret_cast<void*>(&s));
+    }
+};
+
+class DFSink : public QDataflowMetaObject
+{
+public:
+    DFSink(QDataflowModelNode *node, const QStringList &args, QDataflowRuntime *runtime)
+        : QDataflowMetaObject(node), runtime_(runtime)
+    {
+        Q_UNUSED(args);
+
+        setInletTypes({"string"});
+        //setOutletCount(0);
+    }
+
+    void onDataReceved(int inlet, void *data)
+    {
+        if(inlet == 0)
+        {
+            Q_EMIT runtime_->output(node(), *reinterpret_cast<QString*>(data));
+        }
+    }
+
+private:
+    QDataflowRuntime *runtime_;
+};
+
+QDataflowRuntime::QDataflowRuntime(QObject *parent)
+    : QObject(parent)
+{
+    registerBuiltinClasses();
+}
+
+QDataflowModel * QDataflowRuntime::model()
+{
+    return model_;
+}
+
+void QDataflowRuntime::setModel(QDataflowModel *model)
+{
+    if(model_)
+        QObject::disconnect(model_, nullptr, this, nullptr);
+
+    model_ = model;
+    sources_.clear();
+    if(!model_) return;
+
+    QObject::connect(model_, &QDataflowModel::nodeAdded, this, &QDataflowRuntime::setupNode);
+    QObject::connect(model_, &QDataflowModel::nodeRemoved, this, &QDataflowRuntime::onNodeRemoved);
+    QObject::connect(model_, &QDataflowModel::nodeTextChanged, this, &QDataflowRuntime::onNodeTextChanged);
+
+    for(auto *node : as_const(model_->nodes()))
+        setupNode(node);
+}
+
+void QDataflowRuntime::registerClass(const QString &name, const Factory &factory)
+{
+    if(!classes_.contains(name))
+        classNames_ << name;
+    classes_.insert(name, factory);
+}
+
+QStringList QDataflowRuntime::classNames() const
+{
+    return classNames_;
+}
+
+QList<QDataflowModelNode*> QDataflowRuntime::sources() const
+{
+    return sources_;
+}
+
+void QDataflowRuntime::send(long value)
+{
+    for(auto *node : as_const(sources_))
+        if(QDataflowMetaObject *mo = node->dataflowMetaObject())
+            mo->sendData(0, reinterpret_cast<void*>(value));
+}
+
+void QDataflowRuntime::setupNode(QDataflowModelNode *node)
+{
+    sources_.removeAll(node);
+
+    QStringList toks = node->text().split(QRegExp("(\\ |\\t)"));
+    auto it = classes_.constFind(toks[0]);
+    if(it == classes_.constEnd())
+    {
+        node->setValid(false);
+        return;
+    }
+    node->setDataflowMetaObject((*it)(node, toks));
+    if(toks[0] == "source")
+        sources_.push_back(node);
+    node->setValid(true);
+}
+
+void QDataflowRuntime::registerBuiltinClasses()
+{
+    auto binOp = [](QDataflowModelNode *node, const QStringList &args) -> QDataflowMetaObject * {
+        return new DFMathBinOp(node, args);
+    };
+    for(const char *op : {"add", "sub", "mul", "div", "pow"})
+        registerClass(QString::fromLatin1(op), binOp);
+    registerClass(QStringLiteral("source"), [](QDataflowModelNode *node, const QStringList &args) -> QDataflowMetaObject * {
+        return new DFSource(node, args);
+    });
+    registerClass(QStringLiteral("sink"), [this](QDataflowModelNode *node, const QStringList &args) -> QDataflowMetaObject * {
+        return new DFSink(node, args, this);
+    });
+    registerClass(QStringLiteral("num2str"), [](QDataflowModelNode *node, const QStringList &args) -> QDataflowMetaObject * {
+        return new DFNum2Str(node, args);
+    });
+}
+
+void QDataflowRuntime::onNodeRemoved(QDataflowModelNode *node)
+{
+    sources_.removeAll(node);
+}
+
+void QDataflowRuntime::onNodeTextChanged(QDataflowModelNode *node, const QString &text)
+{
+    Q_UNUSED(text);
+    setupNode(node);
+}
@@ -0,0 +1,76 @@
+/* QDataflowCanvas - a dataflow widget for Qt
+ * Copyright (C) 2017-2018 Federico Ferri
+ * Copyright (C) 2018 Kuba Ober
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QDATAFLOWRUNTIME_H
+#define QDATAFLOWRUNTIME_H
+
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QStringList>
+
+#include <functional>
+
+#include "qdataflowmodel.h"
+
+// Attaches the dataflow logic (a QDataflowMetaObject) to each node of a
+// model, chosen by the first word of the node's text. The classes are
+// looked up in a registry, which starts with the built-in classes:
+// source, sink, num2str, and the binary operators add, sub, mul, div, pow.
+//
+// It only depends on QtCore, so that patches can run without a GUI.
+class QDataflowRuntime : public QObject
+{
+    Q_OBJECT
+public:
+    typedef std::function<QDataflowMetaObject * (QDataflowModelNode *node, const QStringList &args)> Factory;
+
+    explicit QDataflowRuntime(QObject *parent = {});
+
+    QDataflowModel * model();
+    // also sets up the nodes already in the model
+    void setModel(QDataflowModel *model);
+
+    void registerClass(const QString &name, const Factory &factory);
+    QStringList classNames() const;
+
+    QList<QDataflowModelNode*> sources() const;
+    // sends value out of every source node
+    void send(long value);
+
+Q_SIGNALS:
+    // a sink node received text
+    void output(QDataflowModelNode *node, const QString &text);
+
+public Q_SLOTS:
+    void setupNode(QDataflowModelNode *node);
+
+protected:
+    void registerBuiltinClasses();
+
+protected Q_SLOTS:
+    void onNodeRemoved(QDataflowModelNode *node);
+    void onNodeTextChanged(QDataflowModelNode *node, const QString &text);
+
+private:
+    QPointer<QDataflowModel> model_;
+    QHash<QString, Factory> classes_;
+    QStringList classNames_;
+    QList<QDataflowModelNode*> sources_;
+};
+
+#endif // QDATAFLOWRUNTIME_H
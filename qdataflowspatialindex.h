@@ -0,0 +1,353 @@
+/* QDataflowCanvas - a dataflow widget for Qt
+ * Copyright (C) 2017-2018 Federico Ferri
+ * Copyright (C) 2018 Kuba Ober
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QDATAFLOWSPATIALINDEX_H
+#define QDATAFLOWSPATIALINDEX_H
+
+#include <QHash>
+#include <QPair>
+#include <QRect>
+#include <QRectF>
+#include <QSet>
+#include <QVector>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// A uniform grid of square cells, mapping each cell to the items whose
+// rectangle overlaps it. Updating an item which stays in the same cells
+// (the common case while dragging) only stores its new rectangle.
+//
+// Items spanning more than maxCellsPerItem() cells (e.g. very long
+// connections) are kept in a separate list which is scanned by every query.
+template<typename T>
+class QDataflowGridIndex
+{
+public:
+    explicit QDataflowGridIndex(qreal cellSize = 256)
+        : cellSize_(cellSize)
+    {
+    }
+
+    qreal cellSize() const {return cellSize_;}
+    int maxCellsPerItem() const {return 64;}
+
+    int size() const {return entries_.size();}
+    bool isEmpty() const {return entries_.isEmpty();}
+    bool contains(T item) const {return entries_.contains(item);}
+    QRectF rect(T item) const {return entries_.value(item).rect;}
+
+    void update(T item, const QRectF &rect)
+    {
+        QRect cells = cellRange(rect);
+        auto it = entries_.find(item);
+        if(it != entries_.end())
+        {
+            it->rect = rect;
+            if(it->cells == cells) return;
+            removeFromCells(item, it->cells);
+            it->cells = cells;
+        }
+        else
+        {
+            Entry entry;
+            entry.rect = rect;
+            entry.cells = cells;
+            entries_.insert(item, entry);
+        }
+        addToCells(item, cells);
+    }
+
+    void remove(T item)
+    {
+        auto it = entries_.find(item);
+        if(it == entries_.end()) return;
+        removeFromCells(item, it->cells);
+        entries_.erase(it);
+    }
+
+    void clear()
+    {
+        cells_.clear();
+        large_.clear();
+        entries_.clear();
+    }
+
+    // the union of all the rectangles; only the items of the outermost
+    // occupied cells (and the large items) are examined
+    QRectF bounds() const
+    {
+        if(entries_.isEmpty()) return {};
+        qreal l = std::numeric_limits<qreal>::max(), t = l, r = -l, b = -l;
+        auto unite = [&](const QRectF &rect) {
+            QRectF n = rect.normalized();
+            l = std::min(l, n.left()); t = std::min(t, n.top());
+            r = std::max(r, n.right()); b = std::max(b, n.bottom());
+        };
+        int minX = std::numeric_limits<int>::max(), minY = minX, maxX = -minX, maxY = -minX;
+        for(auto it = cells_.constBegin(); it != cells_.constEnd(); ++it)
+        {
+            int cx = int(qint32(it.key() >> 32)), cy = int(qint32(it.key() & 0xffffffff));
+            minX = std::min(minX, cx); maxX = std::max(maxX, cx);
+            minY = std::min(minY, cy); maxY = std::max(maxY, cy);
+        }
+        for(auto it = cells_.constBegin(); it != cells_.constEnd(); ++it)
+        {
+            int cx = int(qint32(it.key() >> 32)), cy = int(qint32(it.key() & 0xffffffff));
+            if(cx != minX && cx != maxX && cy != minY && cy != maxY) continue;
+            for(T item : it.value())
+                unite(entries_.constFind(item)->rect);
+        }
+        for(T item : large_)
+            unite(entries_.constFind(item)->rect);
+        return QRectF(QPointF(l, t), QPointF(r, b));
+    }
+
+    // call f(item, rect) once for every item whose rectangle intersects r
+    template<typename F>
+    void visit(const QRectF &r, F f) const
+    {
+        QRect q = cellRange(r);
+        if(qint64(q.width()) * q.height() > cells_.size())
+        {
+            // sparse grid: cheaper to walk the occupied cells
+            for(auto it = cells_.constBegin(); it != cells_.constEnd(); ++it)
+            {
+                int cx = int(qint32(it.key() >> 32)), cy = int(qint32(it.key() & 0xffffffff));
+                if(q.contains(cx, cy))
+                    visitCell(it.value(), cx, cy, q, r, f);
+            }
+        }
+        else
+        {
+            for(int cy = q.top(); cy <= q.bottom(); cy++)
+            {
+                for(int cx = q.left(); cx <= q.right(); cx++)
+                {
+                    auto it = cells_.constFind(key(cx, cy));
+                    if(it != cells_.constEnd())
+                        visitCell(it.value(), cx, cy, q, r, f);
+                }
+            }
+        }
+        for(T item : large_)
+        {
+            const QRectF &itemRect = entries_.constFind(item)->rect;
+            if(intersects(itemRect, r))
+                f(item, itemRect);
+        }
+    }
+
+    // call f(item, rect) once for every item whose rectangle contains p
+    template<typename F>
+    void visit(const QPointF &p, F f) const
+    {
+        visit(QRectF(p, p), f);
+    }
+
+    QVector<T> items(const QRectF &r) const
+    {
+        QVector<T> ret;
+        visit(r, [&ret](T item, const QRectF &) {ret.push_back(item);});
+        return ret;
+    }
+
+    QVector<T> items(const QPointF &p) const
+    {
+        return items(QRectF(p, p));
+    }
+
+    // the k items whose rectangles are closest to p, nearest first; cells
+    // are searched in growing square rings around p, until no unseen item
+    // can be closer than the k-th one found so far
+    QVector<T> nearest(const QPointF &p, int k) const
+    {
+        QVector<QPair<qreal, T>> found;
+        if(k <= 0 || entries_.isEmpty()) return {};
+
+        auto add = [&found, &p](T item, const QRectF &rect) {
+            found.push_back(qMakePair(distance2(rect, p), item));
+        };
+        auto closer = [](const QPair<qreal, T> &a, const QPair<qreal, T> &b) {
+            return a.first < b.first;
+        };
+
+        for(T item : large_)
+            add(item, entries_.constFind(item)->rect);
+
+        QSet<T> seen;
+        auto visitRingCell = [&](int x, int y) {
+            auto it = cells_.constFind(key(x, y));
+            if(it == cells_.constEnd()) return;
+            for(T item : it.value())
+            {
+                if(seen.contains(item)) continue;
+                seen.insert(item);
+                add(item, entries_.constFind(item)->rect);
+            }
+        };
+
+        const int cx = cellCoord(p.x()), cy = cellCoord(p.y());
+        for(int r = 0; ; r++)
+        {
+            if(qint64(2 * r + 1) * (2 * r + 1) > 4 * qint64(cells_.size()))
+            {
+                // the rings outgrew the occupied cells: check every item
+                found.clear();
+                for(auto it = entries_.constBegin(); it != entries_.constEnd(); ++it)
+                    add(it.key(), it->rect);
+                break;
+            }
+
+            for(int x = cx - r; x <= cx + r; x++)
+            {
+                visitRingCell(x, cy - r);
+                if(r > 0) visitRingCell(x, cy + r);
+            }
+            for(int y = cy - r + 1; y <= cy + r - 1; y++)
+            {
+                visitRingCell(cx - r, y);
+                visitRingCell(cx + r, y);
+            }
+
+            if(seen.size() + large_.size() == entries_.size()) break;
+
+            // items beyond ring r are at least r cells away:
+            if(found.size() >= k)
+            {
+                std::nth_element(found.begin(), found.begin() + (k - 1), found.end(), closer);
+                const qreal bound = r * cellSize_;
+                if(found[k - 1].first <= bound * bound) break;
+            }
+        }
+
+        if(found.size() > k)
+        {
+            std::nth_element(found.begin(), found.begin() + (k - 1), found.end(), closer);
+            found.resize(k);
+        }
+        std::sort(found.begin(), found.end(), closer);
+        QVector<T> ret;
+        ret.reserve(found.size());
+        for(const auto &f : found)
+            ret.push_back(f.second);
+        return ret;
+    }
+
+protected:
+    struct Entry
+    {
+        QRectF rect;
+        QRect cells;
+    };
+
+    static quint64 key(int cx, int cy)
+    {
+        return (quint64(quint32(cx)) << 32) | quint64(quint32(cy));
+    }
+
+    // like QRectF::intersects(), but also true for degenerate rectangles
+    static bool intersects(const QRectF &a, const QRectF &b)
+    {
+        QRectF na = a.normalized(), nb = b.normalized();
+        return na.left() <= nb.right() && nb.left() <= na.right() &&
+                na.top() <= nb.bottom() && nb.top() <= na.bottom();
+    }
+
+    // squared distance from p to the closest point of r
+    static qreal distance2(const QRectF &r, const QPointF &p)
+    {
+        QRectF n = r.normalized();
+        qreal dx = std::max(std::max(n.left() - p.x(), p.x() - n.right()), qreal(0));
+        qreal dy = std::max(std::max(n.top() - p.y(), p.y() - n.bottom()), qreal(0));
+        return dx * dx + dy * dy;
+    }
+
+    int cellCoord(qreal v) const
+    {
+        qreal c = std::floor(v / cellSize_);
+        if(c != c) return 0;
+        return int(qBound(qreal(-(1 << 29)), c, qreal(1 << 29)));
+    }
+
+    QRect cellRange(const QRectF &r) const
+    {
+        QRectF n = r.normalized();
+        return QRect(QPoint(cellCoord(n.left()), cellCoord(n.top())),
+                     QPoint(cellCoord(n.right()), cellCoord(n.bottom())));
+    }
+
+    bool isLarge(const QRect &cells) const
+    {
+        return qint64(cells.width()) * cells.height() > maxCellsPerItem();
+    }
+
+    void addToCells(T item, const QRect &cells)
+    {
+        if(isLarge(cells))
+        {
+            large_.push_back(item);
+            return;
+        }
+        for(int cy = cells.top(); cy <= cells.bottom(); cy++)
+            for(int cx = cells.left(); cx <= cells.right(); cx++)
+                cells_[key(cx, cy)].push_back(item);
+    }
+
+    void removeFromCells(T item, const QRect &cells)
+    {
+        if(isLarge(cells))
+        {
+            large_.removeOne(item);
+            return;
+        }
+        for(int cy = cells.top(); cy <= cells.bottom(); cy++)
+        {
+            for(int cx = cells.left(); cx <= cells.right(); cx++)
+            {
+                auto it = cells_.find(key(cx, cy));
+                if(it == cells_.end()) continue;
+                it->removeOne(item);
+                if(it->isEmpty()) cells_.erase(it);
+            }
+        }
+    }
+
+    // an item overlapping several cells of the query is reported only from
+    // the top-left cell of the overlap, so that no result set is needed
+    template<typename F>
+    void visitCell(const QVector<T> &cell, int cx, int cy, const QRect &q, const QRectF &r, F &f) const
+    {
+        for(T item : cell)
+        {
+            const Entry &entry = *entries_.constFind(item);
+            if(cx != std::max(entry.cells.left(), q.left()) || cy != std::max(entry.cells.top(), q.top()))
+                continue;
+            if(intersects(entry.rect, r))
+                f(item, entry.rect);
+        }
+    }
+
+private:
+    qreal cellSize_;
+    QHash<quint64, QVector<T>> cells_;
+    QVector<T> large_;
+    QHash<T, Entry> entries_;
+};
+
+#endif // QDATAFLOWSPATIALINDEX_H